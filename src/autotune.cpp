@@ -0,0 +1,128 @@
+#include "autotune.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "dispatch.h"
+
+// Nombre de pas chronométrés par candidat, on garde le meilleur
+static const int tune_repetitions = 2;
+
+static bool read_cache(const std::string& path, const TuneKey& key, EngineConfig& cfg) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream iss(line);
+    TuneKey k;
+    EngineConfig c = cfg;
+    if (iss >> k.n >> k.width >> k.height >> k.threads >> k.cutoff >> k.skin >> c.engine >> c.row_grain >> c.particle_grain >> c.tile_rows
+        >> c.tile_cols >> c.tile_charges) {
+      if (k == key) {
+        cfg = c;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void write_cache(const std::string& path, const TuneKey& key, const EngineConfig& c) {
+  std::ofstream ofs(path, std::ios::app);
+  // la portée et la marge sont relues et comparées exactement
+  ofs << std::setprecision(std::numeric_limits<double>::max_digits10);
+  ofs << key.n << " " << key.width << " " << key.height << " " << key.threads << " " << key.cutoff << " " << key.skin
+      << " " << c.engine << " " << c.row_grain
+      << " " << c.particle_grain << " " << c.tile_rows << " " << c.tile_cols << " " << c.tile_charges << "\n";
+}
+
+std::vector<EngineConfig> autotune_candidates(const EngineConfig& base) {
+  std::vector<EngineConfig> candidates;
+  EngineConfig c = base;
+
+  // le moteur série calcule toutes les paires, sans tenir compte de la
+  // portée des forces
+  if (base.cutoff <= 0) {
+    c.engine = ENGINE_SERIAL;
+    candidates.push_back(c);
+  }
+
+  c.engine = ENGINE_TBB;
+  for (int row_grain : {1, 4, 16}) {
+    for (int particle_grain : {1, 32}) {
+      c.row_grain = row_grain;
+      c.particle_grain = particle_grain;
+      candidates.push_back(c);
+    }
+  }
+  c.row_grain = base.row_grain;
+  c.particle_grain = base.particle_grain;
+
+  c.engine = ENGINE_TILED;
+  for (auto [rows, cols] : {std::pair{16, 16}, std::pair{32, 32}, std::pair{16, 64}}) {
+    for (int charges : {128, 512}) {
+      c.tile_rows = rows;
+      c.tile_cols = cols;
+      c.tile_charges = charges;
+      candidates.push_back(c);
+    }
+  }
+  c.tile_rows = base.tile_rows;
+  c.tile_cols = base.tile_cols;
+  c.tile_charges = base.tile_charges;
+
+  c.engine = ENGINE_ROW_SWEEP;
+  for (int charges : {64, 256, 1024}) {
+    c.tile_charges = charges;
+    candidates.push_back(c);
+  }
+  return candidates;
+}
+
+EngineConfig autotune(const EngineConfig& base, const std::vector<Particle>& particles, double dt, int substeps,
+                      const std::string& cache_path, bool verbose) {
+  TuneKey key{int(particles.size()), base.width, base.height, effective_concurrency(), base.cutoff, base.skin};
+  EngineConfig best = base;
+  if (read_cache(cache_path, key, best)) {
+    if (verbose) {
+      std::cout << "autotune: " << describe(best) << " (" << cache_path << ")" << std::endl;
+    }
+    return best;
+  }
+
+  double best_time = std::numeric_limits<double>::max();
+  for (const EngineConfig& c : autotune_candidates(base)) {
+    IPotential* engine = make_engine(c);
+    std::vector<Particle> charge(particles);
+    double lo, hi;
+    double elapsed = std::numeric_limits<double>::max();
+    for (int rep = 0; rep < tune_repetitions; rep++) {
+      auto t1 = std::chrono::steady_clock::now();
+      engine->move_particles(charge, dt, substeps);
+      engine->compute_field(charge, lo, hi);
+      auto t2 = std::chrono::steady_clock::now();
+      elapsed = std::min(elapsed, std::chrono::duration<double>(t2 - t1).count());
+    }
+    delete engine;
+
+    if (verbose) {
+      std::cout << "autotune: " << describe(c) << " " << elapsed << " s" << std::endl;
+    }
+    if (elapsed < best_time) {
+      best_time = elapsed;
+      best = c;
+    }
+  }
+
+  write_cache(cache_path, key, best);
+  if (verbose) {
+    std::cout << "autotune: " << describe(best) << " selected" << std::endl;
+  }
+  return best;
+}
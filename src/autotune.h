@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "engine.h"
+#include "particle.h"
+
+// Signature d'un problème: le meilleur moteur en dépend
+struct TuneKey {
+  int n;
+  int width;
+  int height;
+  int threads;
+  double cutoff;  // portée des forces, 0 sans coupure
+  double skin;
+
+  bool operator==(const TuneKey&) const = default;
+};
+
+// Configurations essayées par l'auto-tuning: moteur série (sauf avec une
+// portée des forces, qu'il ignore), moteur tbb avec plusieurs grains,
+// moteur en tuiles avec plusieurs formes de tuiles et balayage de lignes
+// avec plusieurs tailles de blocs. Seuls les moteurs exacts sont
+// candidats (pas de calcul approché ni FFT).
+std::vector<EngineConfig> autotune_candidates(const EngineConfig& base);
+
+// Retourner la configuration la plus rapide pour ces particules. Au premier
+// appel pour une signature, chaque candidat est chronométré sur quelques
+// pas de temps et le gagnant est ajouté au fichier cache_path, une ligne
+// par signature:
+//
+//   n width height threads cutoff skin engine row_grain particle_grain tile_rows tile_cols tile_charges
+//
+// Les appels suivants relisent simplement le fichier.
+EngineConfig autotune(const EngineConfig& base, const std::vector<Particle>& particles, double dt, int substeps,
+                      const std::string& cache_path, bool verbose);
@@ -0,0 +1,67 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "colormap.h"
+#include "experiments.h"
+#include "imageio.h"
+#include "potentialparallel.h"
+#include "uqam/tp.h"
+
+/*
+ * Coût d'encodage d'une image du potentiel selon le format de sortie:
+ * taille en octets et temps moyen par image.
+ *
+ *   bench_images [résolution] [répétitions] [particules]
+ */
+int main(int argc, char** argv) {
+  int resolution = argc > 1 ? std::stoi(argv[1]) : 2048;
+  int repeat = argc > 2 ? std::stoi(argv[2]) : 5;
+  int numpart = argc > 3 ? std::stoi(argv[3]) : 25;
+
+  ColorMap cmap;
+  cmap.load(SOURCE_DIR "/data/colormap_parula.png");
+
+  std::vector<Particle> particles;
+  experiment_random_counter(numpart, particles, 0);
+  PotentialParallel engine(resolution, resolution);
+  double lo, hi;
+  engine.compute_field(particles, lo, hi);
+  cmap.update_scale(lo, hi);
+  // coloriser une fois, seul l'encodage est mesuré ensuite
+  std::ostringstream neant;
+  engine.m_image.format = ImageFormat::PPM;
+  engine.save_solution(neant, cmap);
+
+  struct Case {
+    const char* name;
+    ImageOptions opt;
+  };
+  const Case cases[] = {
+      {"ppm", {ImageFormat::PPM}},
+      {"qoi", {ImageFormat::QOI}},
+      {"y4m", {ImageFormat::Y4M}},
+      {"png", {ImageFormat::PNG}},
+      {"png level 1 no filter", {ImageFormat::PNG, 1, 0}},
+      {"png level 1", {ImageFormat::PNG, 1, -1}},
+      {"png level 0 no filter", {ImageFormat::PNG, 0, 0}},
+      {"png level 9", {ImageFormat::PNG, 9, -1}},
+  };
+
+  std::cout << "# " << resolution << "x" << resolution << ", " << numpart << " particules\n";
+  std::cout << "# format octets ms/image\n";
+  for (const Case& c : cases) {
+    size_t bytes = 0;
+    auto t1 = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) {
+      std::ostringstream oss;
+      write_image(oss, engine.m_img, c.opt);
+      bytes = oss.tellp();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - t1;
+    std::cout << std::left << std::setw(24) << c.name << " " << std::setw(10) << bytes << " " << std::fixed
+              << std::setprecision(1) << elapsed.count() / repeat << "\n";
+  }
+}
@@ -0,0 +1,118 @@
+#include "checkpoint.h"
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+const int fields = 9;
+
+template <typename T>
+void put(std::vector<char>& buf, const T& v) {
+  const char* p = reinterpret_cast<const char*>(&v);
+  buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+bool get(std::FILE* f, T& v) {
+  return std::fread(&v, sizeof(T), 1, f) == 1;
+}
+
+}  // namespace
+
+void write_checkpoint(const std::string& path, const Checkpoint& cp) {
+  std::vector<char> buf;
+  buf.reserve(48 + cp.particles.size() * fields * sizeof(double) + cp.ids.size() * sizeof(std::int32_t));
+  buf.insert(buf.end(), {'C', 'K', 'P', '1'});
+  put(buf, std::int32_t(cp.iter));
+  put(buf, cp.time);
+  put(buf, cp.lo);
+  put(buf, cp.hi);
+  put(buf, std::int64_t(cp.particles.size()));
+  for (const Particle& c : cp.particles) {
+    for (double v : {c.m_x(0), c.m_x(1), c.m_p(0), c.m_p(1), c.m_v(0), c.m_v(1), c.m_f(0), c.m_f(1), c.m_q}) {
+      put(buf, v);
+    }
+  }
+  put(buf, std::int64_t(cp.ids.size()));
+  for (int id : cp.ids) {
+    put(buf, std::int32_t(id));
+  }
+
+  // write and sync a temporary file, then replace the checkpoint
+  std::string tmp = path + ".tmp";
+  std::FILE* f = std::fopen(tmp.c_str(), "wb");
+  if (!f) {
+    throw std::runtime_error("cannot create " + tmp);
+  }
+  bool ok = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+  ok = std::fflush(f) == 0 && ok;
+  ok = ::fsync(::fileno(f)) == 0 && ok;
+  ok = std::fclose(f) == 0 && ok;
+  if (!ok) {
+    std::filesystem::remove(tmp);
+    throw std::runtime_error("cannot write " + tmp);
+  }
+  std::filesystem::rename(tmp, path);
+}
+
+bool read_checkpoint(const std::string& path, Checkpoint& cp) {
+  std::FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  // read into a local state: cp is left untouched if the file is invalid
+  Checkpoint read;
+  char magic[4];
+  std::int32_t iter = 0;
+  std::int64_t count = 0;
+  std::int64_t nids = 0;
+  bool ok = std::fread(magic, 1, 4, f) == 4 && std::memcmp(magic, "CKP1", 4) == 0;
+  ok = ok && get(f, iter) && get(f, read.time) && get(f, read.lo) && get(f, read.hi) && get(f, count) && count >= 0;
+  read.iter = iter;
+  for (std::int64_t i = 0; ok && i < count; i++) {
+    double v[fields] = {};
+    ok = std::fread(v, sizeof(double), fields, f) == fields;
+    Particle c({v[0], v[1]}, {v[4], v[5]}, v[8]);
+    c.m_p = {v[2], v[3]};
+    c.m_f = {v[6], v[7]};
+    read.particles.push_back(c);
+  }
+  ok = ok && get(f, nids) && (nids == 0 || nids == count);
+  read.ids.resize(ok ? nids : 0);
+  for (std::int64_t i = 0; ok && i < nids; i++) {
+    std::int32_t id;
+    ok = get(f, id);
+    read.ids[i] = id;
+  }
+  std::fclose(f);
+  if (!ok) {
+    return false;
+  }
+  cp = std::move(read);
+  return true;
+}
+
+void CheckpointWriter::submit(Checkpoint cp) {
+  wait();
+  m_thread = std::thread([this, cp = std::move(cp)] {
+    try {
+      write_checkpoint(m_path, cp);
+    } catch (const std::exception& e) {
+      // a failed checkpoint must not stop the simulation
+      std::cerr << "checkpoint: " << e.what() << std::endl;
+    }
+  });
+}
+
+void CheckpointWriter::wait() {
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "particle.h"
+
+/*
+ * Simulation checkpoints.
+ *
+ * Binary file, little-endian:
+ *
+ *   char     magic[4]    "CKP1"
+ *   int32    iter
+ *   float64  time
+ *   float64  lo, hi      color scale
+ *   int64    count
+ *   float64  particles[count][9]   x, y, px, py, vx, vy, fx, fy, q
+ *   int64    ids                   0 or count
+ *   int32    id[ids]               Morton permutation (see IPotential::m_ids)
+ *
+ * The file is written next to its final path and renamed once complete,
+ * so a crash during the write leaves the previous checkpoint intact.
+ */
+struct Checkpoint {
+  int iter = 0;
+  double time = 0.0;
+  double lo = 0.0;
+  double hi = 0.0;
+  std::vector<Particle> particles;
+  std::vector<int> ids;
+};
+
+// Write a checkpoint atomically; throws std::runtime_error on failure
+void write_checkpoint(const std::string& path, const Checkpoint& cp);
+
+// Read a checkpoint, false if the file does not exist or is invalid (cp is
+// then left unchanged)
+bool read_checkpoint(const std::string& path, Checkpoint& cp);
+
+// Writes checkpoints on a background thread, one at a time. The state is
+// copied by the caller, so the simulation can go on during the write.
+class CheckpointWriter {
+public:
+  explicit CheckpointWriter(std::string path) : m_path(std::move(path)) {
+  }
+
+  ~CheckpointWriter() {
+    wait();
+  }
+
+  // Start writing cp, after the previous write (if any) is done
+  void submit(Checkpoint cp);
+
+  // Wait for the current write
+  void wait();
+
+private:
+  std::string m_path;
+  std::thread m_thread;
+};
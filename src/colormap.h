@@ -31,6 +31,11 @@ struct ColorMap {
   }
 
   inline png::rgb_pixel get_color(double val) {
+    return m_colors[get_index(val)];
+  }
+
+  // Indice dans la carte de couleurs de la valeur passée en argument
+  inline int get_index(double val) const {
     val = std::clamp(val, m_lo, m_hi);
     // Astuce: comme ici le dénominateur est constant,
     // il est beaucoup plus rapide de multiplier par
@@ -41,7 +46,7 @@ struct ColorMap {
     // double norm = (1 + std::tanh(6.5 * (val - m_lo) * m_scale_inv)) / 2;
     double norm = (val - m_lo) * m_scale_inv;
     int idx = norm * (m_colors.size() - 1);
-    return m_colors[idx];
+    return idx;
   }
 
   std::vector<png::rgb_pixel> m_colors;
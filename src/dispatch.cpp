@@ -0,0 +1,124 @@
+#include "dispatch.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "colormap.h"
+#include "particle.h"
+
+std::string to_string(Execution e) {
+  switch (e) {
+    case Execution::Serial:
+      return "serial";
+    case Execution::Rows:
+      return "rows";
+    default:
+      return "charges";
+  }
+}
+
+int effective_concurrency() {
+  int limit = int(tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism));
+  return std::min(limit, tbb::this_task_arena::max_concurrency());
+}
+
+// Plancher du coût de lancement par fil, en secondes
+static const double min_launch = 1e-6;
+
+// Durée moyenne en secondes d'un appel de f, sur `rep` répétitions
+template <typename F>
+static double time_it(int rep, F&& f) {
+  auto t1 = std::chrono::steady_clock::now();
+  for (int r = 0; r < rep; r++) {
+    f();
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(t2 - t1).count() / rep;
+}
+
+static CostModel calibrate() {
+  CostModel m;
+
+  // parallel loop doing nothing, one task per thread, measured on the whole
+  // machine whatever the arena of the first caller. Waking a sleeping
+  // worker costs at least a microsecond, which a loop that finishes before
+  // the workers join does not show.
+  tbb::task_arena machine;
+  int threads = machine.max_concurrency();
+  double empty = machine.execute([&] {
+    return time_it(200, [&] {
+      tbb::parallel_for(tbb::blocked_range<int>(0, threads, 1), [](const tbb::blocked_range<int>&) {},
+                        tbb::simple_partitioner());
+    });
+  });
+  m.launch = std::max(empty / threads, min_launch);
+
+  // the inner loop of compute_field
+  std::vector<Particle> charge;
+  for (int c = 0; c < 64; c++) {
+    charge.push_back(Particle({0.01 * c, 0.5}, {0, 0}, 1));
+  }
+  volatile double sink = 0.0;
+  const int points = 256;
+  double field = time_it(10, [&] {
+    double v = 0.0;
+    for (int p = 0; p < points; p++) {
+      for (const Particle& c : charge) {
+        v += c.potential_at({1.0 * p / points, 0.25});
+      }
+    }
+    sink = v;
+  });
+  m.pair_cost = field / (points * charge.size());
+
+  // the inner loop of save_solution
+  ColorMap cmap;
+  cmap.m_colors.resize(64);
+  cmap.set_scale(0.0, 1.0);
+  png::image<png::rgb_pixel> img(points, 1);
+  double save = time_it(10, [&] {
+    for (int p = 0; p < points; p++) {
+      img.set_pixel(p, 0, cmap.get_color(1.0 * p / points));
+    }
+  });
+  m.pixel_cost = save / points;
+  (void)sink;
+  return m;
+}
+
+const CostModel& CostModel::calibrated() {
+  static const CostModel model = calibrate();
+  return model;
+}
+
+bool CostModel::worth_parallel(double work) const {
+  int p = effective_concurrency();
+  return p > 1 && work / p + launch * p < work;
+}
+
+Execution CostModel::field(long rows, long cols, long n) const {
+  if (!worth_parallel(rows * cols * n * pair_cost)) {
+    return Execution::Serial;
+  }
+  // each task needs a few rows to balance the load, and each partial grid
+  // of the charge split must stay small next to the work it saves
+  int p = effective_concurrency();
+  if (rows < 4 * p && n > rows * cols / 4) {
+    return Execution::Charges;
+  }
+  return Execution::Rows;
+}
+
+Execution CostModel::move(long n, int substeps) const {
+  return worth_parallel(n * n * substeps * pair_cost) ? Execution::Charges : Execution::Serial;
+}
+
+Execution CostModel::save(long pixels) const {
+  return worth_parallel(pixels * pixel_cost) ? Execution::Rows : Execution::Serial;
+}
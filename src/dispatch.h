@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+// Façon d'exécuter une phase de la simulation
+enum class Execution {
+  Serial,   // boucle série
+  Rows,     // parallèle sur les lignes de l'image
+  Charges,  // parallèle sur les charges
+};
+
+std::string to_string(Execution e);
+
+// Threads actually available: the size of the current arena, bounded by
+// the global limit (option -t, tbb::global_control) that the arena does
+// not reflect
+int effective_concurrency();
+
+/*
+ * Cost model of the three phases of a time step.
+ *
+ * A phase of W seconds of serial work is split over p threads only if
+ * W / p + overhead(p) < W, where overhead(p) is the measured cost of
+ * launching and joining a parallel loop on p threads. The work is
+ * estimated from calibrated unit costs:
+ *
+ *   compute_field:  pixels x n       x pair_cost
+ *   move_particles: n^2 x substeps   x pair_cost
+ *   save_solution:  pixels           x pixel_cost
+ *
+ * compute_field is split over charges as well when the image has too few
+ * rows to keep p threads busy and there are many more charges than rows.
+ */
+struct CostModel {
+  double launch;      // seconds per parallel loop, per participating thread
+  double pair_cost;   // seconds per charge-point interaction
+  double pixel_cost;  // seconds per colorized pixel
+
+  // Measured once per process, on first use
+  static const CostModel& calibrated();
+
+  Execution field(long rows, long cols, long n) const;
+  Execution move(long n, int substeps) const;
+  Execution save(long pixels) const;
+
+  // True if splitting `work` seconds over the threads available to the
+  // current arena (see effective_concurrency) pays off
+  bool worth_parallel(double work) const;
+};
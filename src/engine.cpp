@@ -0,0 +1,75 @@
+#include "engine.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#include "potentialfast.h"
+#include "potentialfft.h"
+#include "potentialparallel.h"
+#include "potentialrowsweep.h"
+#include "potentialtiled.h"
+
+IPotential* make_engine(const EngineConfig& cfg) {
+  if (cfg.engine == ENGINE_SERIAL) {
+    return new PotentialSerial(cfg.width, cfg.height);
+  }
+
+  PotentialParallel* engine;
+  if (cfg.engine == ENGINE_TBB) {
+    engine = new PotentialParallel(cfg.width, cfg.height);
+  } else if (cfg.engine == ENGINE_TILED) {
+    engine = new PotentialTiled(cfg.width, cfg.height, cfg.tile_rows, cfg.tile_cols, cfg.tile_charges);
+  } else if (cfg.engine == ENGINE_ROW_SWEEP) {
+    engine = new PotentialRowSweep(cfg.width, cfg.height, cfg.tile_charges);
+  } else if (cfg.engine == ENGINE_FAST) {
+    engine = new PotentialFast(cfg.width, cfg.height, cfg.newton, cfg.tile_charges);
+  } else if (cfg.engine == ENGINE_FFT) {
+    engine = new PotentialFFT(cfg.width, cfg.height, cfg.fft_cic);
+  } else {
+    throw std::runtime_error("unknown engine " + std::to_string(cfg.engine));
+  }
+  engine->m_row_grain = cfg.row_grain;
+  engine->m_particle_grain = cfg.particle_grain;
+  engine->m_dispatch = cfg.dispatch;
+  engine->m_efield = cfg.efield;
+  engine->m_cutoff = cfg.cutoff;
+  engine->m_skin = cfg.skin;
+  engine->m_periodic = cfg.periodic;
+  engine->m_ewald_accuracy = cfg.ewald_accuracy;
+  // seul le moteur tbb calcule le champs par bandes de noeud
+  if (cfg.numa && cfg.engine == ENGINE_TBB) {
+    engine->set_numa(true);
+  }
+  return engine;
+}
+
+std::string describe(const EngineConfig& cfg) {
+  std::ostringstream oss;
+  switch (cfg.engine) {
+    case ENGINE_SERIAL:
+      oss << "serial";
+      break;
+    case ENGINE_TBB:
+      oss << "tbb row_grain=" << cfg.row_grain << " particle_grain=" << cfg.particle_grain;
+      if (cfg.periodic) {
+        oss << " periodic accuracy=" << cfg.ewald_accuracy;
+      }
+      break;
+    case ENGINE_TILED:
+      oss << "tiled " << cfg.tile_rows << "x" << cfg.tile_cols << "x" << cfg.tile_charges;
+      break;
+    case ENGINE_ROW_SWEEP:
+      oss << "row sweep block=" << cfg.tile_charges;
+      break;
+    case ENGINE_FAST:
+      oss << "fast newton=" << cfg.newton << " block=" << cfg.tile_charges;
+      break;
+    case ENGINE_FFT:
+      oss << "fft " << (cfg.fft_cic ? "cic" : "nearest");
+      break;
+    default:
+      oss << "engine " << cfg.engine;
+      break;
+  }
+  return oss.str();
+}
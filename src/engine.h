@@ -0,0 +1,42 @@
+#pragma once
+
+#include "potential.h"
+
+// Moteurs disponibles (option -p)
+enum Engine {
+  ENGINE_AUTO = -1,
+  ENGINE_SERIAL = 0,
+  ENGINE_TBB = 1,
+  ENGINE_TILED = 2,
+  ENGINE_ROW_SWEEP = 3,
+  ENGINE_FAST = 4,
+  ENGINE_FFT = 5,
+};
+
+// Paramètres de construction d'un moteur
+struct EngineConfig {
+  int engine = ENGINE_SERIAL;
+  int width = 512;
+  int height = 512;
+  int row_grain = 1;       // grain des lignes (moteur tbb)
+  int particle_grain = 1;  // grain des particules (moteurs tbb)
+  int tile_rows = 32;
+  int tile_cols = 32;
+  int tile_charges = 256;
+  int newton = 2;
+  bool fft_cic = false;
+  bool numa = false;             // une task_arena par noeud NUMA (moteur tbb)
+  bool dispatch = true;          // modèle de coût série/parallèle par phase (moteurs tbb)
+  bool efield = false;           // champs électrique calculé avec le potentiel (moteur tbb)
+  double cutoff = 0.0;           // portée des forces, 0 sans coupure (moteurs tbb)
+  double skin = 0.05;            // marge des listes de Verlet au-delà de la portée
+  bool periodic = false;         // carré unité périodique, sommes d'Ewald (moteur tbb)
+  double ewald_accuracy = 1e-4;  // précision relative visée des sommes d'Ewald
+};
+
+// Créer le moteur décrit par la configuration (à libérer avec delete).
+// Un moteur inconnu, ou ENGINE_AUTO, lève std::runtime_error.
+IPotential* make_engine(const EngineConfig& cfg);
+
+// Description courte de la configuration, pour l'affichage
+std::string describe(const EngineConfig& cfg);
@@ -0,0 +1,130 @@
+#include "ensemble.h"
+
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "experiments.h"
+
+namespace {
+
+template <typename T>
+T parse_value(const std::string& key, const std::string& value, int line) {
+  T v{};
+  auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+  if (ec != std::errc() || end != value.data() + value.size()) {
+    std::ostringstream msg;
+    msg << "line " << line << ": invalid value for " << key << ": " << value;
+    throw std::runtime_error(msg.str());
+  }
+  return v;
+}
+
+}  // namespace
+
+std::vector<Job> parse_jobs(std::istream& is, const Job& base) {
+  std::vector<Job> jobs;
+  std::string text;
+  int line = 0;
+  while (std::getline(is, text)) {
+    line++;
+    std::istringstream tokens(text);
+    std::string token;
+    if (!(tokens >> token) || token[0] == '#') {
+      continue;
+    }
+    Job job = base;
+    job.name = "job" + std::to_string(jobs.size());
+    bool seeded = false;
+    do {
+      size_t eq = token.find('=');
+      if (eq == std::string::npos) {
+        throw std::runtime_error("line " + std::to_string(line) + ": expected key=value: " + token);
+      }
+      std::string key = token.substr(0, eq);
+      std::string value = token.substr(eq + 1);
+      if (key == "name") {
+        job.name = value;
+      } else if (key == "e") {
+        job.experiment = parse_value<int>(key, value, line);
+      } else if (key == "n") {
+        job.numpart = parse_value<int>(key, value, line);
+      } else if (key == "seed") {
+        job.seed = parse_value<std::uint64_t>(key, value, line);
+        seeded = true;
+      } else if (key == "i") {
+        job.max_iter = parse_value<int>(key, value, line);
+      } else if (key == "dt") {
+        job.dt = parse_value<double>(key, value, line);
+      } else if (key == "s") {
+        job.substeps = parse_value<int>(key, value, line);
+      } else if (key == "p") {
+        job.engine.engine = parse_value<int>(key, value, line);
+      } else if (key == "r") {
+        job.engine.width = job.engine.height = parse_value<int>(key, value, line);
+      } else if (key == "us") {
+        job.update_scale = parse_value<int>(key, value, line) != 0;
+      } else if (key == "o") {
+        job.outfmt = value;
+      } else {
+        throw std::runtime_error("line " + std::to_string(line) + ": unknown key " + key);
+      }
+    } while (tokens >> token);
+    // les autres expériences ne dépendent pas de la graine: un balayage
+    // donnerait des simulations identiques
+    if (seeded && job.experiment != 0 && job.experiment != 4) {
+      throw std::runtime_error("line " + std::to_string(line) + ": seed only applies to e=0 and e=4");
+    }
+    if (job.engine.engine == ENGINE_AUTO) {
+      throw std::runtime_error("line " + std::to_string(line) + ": auto-tuning is not available in ensembles");
+    }
+    if (job.engine.engine < ENGINE_SERIAL || job.engine.engine > ENGINE_FFT) {
+      throw std::runtime_error("line " + std::to_string(line) + ": unknown engine " + std::to_string(job.engine.engine));
+    }
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+std::vector<std::vector<Particle>> run_ensemble(const std::vector<Job>& jobs, const ColorMap& cmap, bool verbose) {
+  for (const Job& job : jobs) {
+    std::filesystem::path basedir = std::filesystem::path(job.outfmt).parent_path();
+    if (!basedir.empty() && !std::filesystem::exists(basedir)) {
+      std::filesystem::create_directories(basedir);
+    }
+  }
+
+  std::vector<std::vector<Particle>> results(jobs.size());
+  tbb::task_group group;
+  for (size_t j = 0; j < jobs.size(); j++) {
+    group.run([&, j] {
+      // a thread waiting inside this job's loops only takes work of this
+      // job, so a short job is never held up behind a long one
+      tbb::this_task_arena::isolate([&] {
+        const Job& job = jobs[j];
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Particle>& particles = results[j];
+        make_experiment(job.experiment, job.numpart, job.seed, particles);
+        ColorMap job_cmap = cmap;
+        std::unique_ptr<IPotential> simulator(make_engine(job.engine));
+        simulator->m_progress = false;
+        simulator->run(particles, job.max_iter, job.dt, job.substeps, job.update_scale, job_cmap, job.outfmt, false);
+        if (verbose) {
+          std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+          std::ostringstream line;
+          line << "ensemble: " << job.name << " " << describe(job.engine) << " " << elapsed.count() << " s\n";
+          std::cout << line.str() << std::flush;
+        }
+      });
+    });
+  }
+  group.wait();
+  return results;
+}
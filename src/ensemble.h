@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "colormap.h"
+#include "engine.h"
+
+// Une simulation d'un ensemble
+struct Job {
+  std::string name;
+  EngineConfig engine;
+  int experiment = 0;
+  int numpart = 10;
+  std::uint64_t seed = 0;
+  int max_iter = 10;
+  double dt = 1e-9;
+  int substeps = 10;
+  bool update_scale = false;
+  std::string outfmt;  // gabarit des images, aucune si vide
+};
+
+// Lire une liste de simulations, une par ligne, sous la forme de paires
+// clé=valeur qui remplacent les valeurs de `base`:
+//
+//   name=a e=4 seed=3 n=100 i=20 dt=1e-9 s=10 p=1 r=128 us=1 o=results/a-{:06d}.png
+//
+// Les lignes vides et celles qui commencent par # sont ignorées. Une clé
+// inconnue ou une valeur invalide lève std::runtime_error, de même que
+// seed avec une expérience qui n'en dépend pas (e différent de 0 et 4).
+std::vector<Job> parse_jobs(std::istream& is, const Job& base);
+
+// Exécuter toutes les simulations dans le même processus: chacune est une
+// tâche d'un tbb::task_group et ses boucles parallèles sont imbriquées dans
+// le même groupe de fils, ce qui occupe tous les coeurs même si chaque
+// simulation est petite. La carte de couleurs est chargée une seule fois;
+// chaque simulation en reçoit une copie pour son échelle. Retourne les
+// particules finales de chaque simulation.
+std::vector<std::vector<Particle>> run_ensemble(const std::vector<Job>& jobs, const ColorMap& cmap, bool verbose);
@@ -0,0 +1,272 @@
+#include "ewald.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "potential.h"
+
+namespace {
+
+const int order = 4;  // cubic B-splines
+
+// Weights of the 4 mesh points floor(u) - 3 .. floor(u) for the fractional
+// part w of u, and their derivatives with respect to u
+void bspline(double w, double* m, double* dm) {
+  double w2 = w * w;
+  double w3 = w2 * w;
+  double v = 1.0 - w;
+  m[0] = v * v * v / 6.0;
+  m[1] = (3.0 * w3 - 6.0 * w2 + 4.0) / 6.0;
+  m[2] = (-3.0 * w3 + 3.0 * w2 + 3.0 * w + 1.0) / 6.0;
+  m[3] = w3 / 6.0;
+  if (dm) {
+    dm[0] = -v * v / 2.0;
+    dm[1] = (3.0 * w2 - 4.0 * w) / 2.0;
+    dm[2] = (-3.0 * w2 + 2.0 * w + 1.0) / 2.0;
+    dm[3] = w2 / 2.0;
+  }
+}
+
+// 1 / |b(m)|^2 of the B-spline interpolation of exp(2 pi i m u / K)
+double bspline_modulus(int m, int mesh) {
+  // M4(1), M4(2), M4(3)
+  const double knots[order - 1] = {1.0 / 6.0, 4.0 / 6.0, 1.0 / 6.0};
+  std::complex<double> sum = 0.0;
+  for (int j = 0; j < order - 1; j++) {
+    double angle = 2.0 * std::numbers::pi * m * j / mesh;
+    sum += knots[j] * std::complex<double>(std::cos(angle), std::sin(angle));
+  }
+  return std::norm(sum);
+}
+
+// 2D transform of a square mesh, rows then columns
+void transform(const FFT& fft, std::vector<std::complex<double>>& a, bool inverse) {
+  int n = fft.size();
+  tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      fft.transform(&a[IDX2(i, 0, n)], inverse);
+    }
+  });
+  tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    std::vector<std::complex<double>> col(n);
+    for (int j = r.begin(); j < r.end(); j++) {
+      for (int i = 0; i < n; i++) {
+        col[i] = a[IDX2(i, j, n)];
+      }
+      fft.transform(col.data(), inverse);
+      for (int i = 0; i < n; i++) {
+        a[IDX2(i, j, n)] = col[i];
+      }
+    }
+  });
+}
+
+// Position in [0, 1)
+double wrap_unit(double v) {
+  v -= std::floor(v);
+  return v < 1.0 ? v : 0.0;
+}
+
+}  // namespace
+
+Vector2d EwaldPME::wrap(const Vector2d& x) {
+  return {wrap_unit(x(0)), wrap_unit(x(1))};
+}
+
+EwaldPME::EwaldPME(int n, double accuracy) : m_charges(n), m_accuracy(accuracy), m_fft(1) {
+  double s = std::sqrt(-std::log(accuracy));
+  m_cutoff = std::clamp(std::sqrt(40.0 / (std::numbers::pi * std::max(n, 1))), 0.01, 0.5);
+  m_alpha = s / m_cutoff;
+  // erfc(G_max / (2 alpha)) = accuracy; the mesh resolves up to 3 G_max
+  // (pi K) so the spline interpolation error stays below the accuracy
+  double g_max = 2.0 * m_alpha * s;
+  m_mesh = FFT::next_pow2(std::max(16, int(std::ceil(3.0 * g_max / std::numbers::pi))));
+  m_fft = FFT(m_mesh);
+  m_self = 2.0 * m_alpha / std::sqrt(std::numbers::pi);
+
+  int mesh = m_mesh;
+  std::vector<double> modulus(mesh);
+  for (int m = 0; m < mesh; m++) {
+    modulus[m] = bspline_modulus(m, mesh);
+  }
+  m_influence.assign(mesh * mesh, 0.0);
+  for (int i = 0; i < mesh; i++) {
+    int mi = i <= mesh / 2 ? i : i - mesh;
+    for (int j = 0; j < mesh; j++) {
+      int mj = j <= mesh / 2 ? j : j - mesh;
+      if (mi == 0 && mj == 0) {
+        continue;
+      }
+      double g = 2.0 * std::numbers::pi * std::sqrt(1.0 * mi * mi + 1.0 * mj * mj);
+      double kernel = 2.0 * std::numbers::pi * std::erfc(g / (2.0 * m_alpha)) / g;
+      m_influence[IDX2(i, j, mesh)] = kernel / (modulus[i] * modulus[j]);
+    }
+  }
+
+  m_cells = int(1.0 / m_cutoff);
+  if (m_cells < 3) {
+    m_cells = 0;
+  }
+}
+
+void EwaldPME::update(const std::vector<Vector2d>& x, const std::vector<double>& q) {
+  int n = x.size();
+  int mesh = m_mesh;
+  m_x.resize(n);
+  m_q = q;
+  double total = 0.0;
+  for (int c = 0; c < n; c++) {
+    m_x[c] = wrap(x[c]);
+    total += q[c];
+  }
+  m_background = -2.0 * std::sqrt(std::numbers::pi) * total / m_alpha;
+
+  // spread the charges: O(16 n), serial to avoid concurrent updates
+  m_grid.assign(mesh * mesh, 0.0);
+  for (int c = 0; c < n; c++) {
+    double ux = m_x[c](0) * mesh;
+    double uy = m_x[c](1) * mesh;
+    int fx = int(ux);
+    int fy = int(uy);
+    double mx[order], my[order];
+    bspline(ux - fx, mx, nullptr);
+    bspline(uy - fy, my, nullptr);
+    for (int a = 0; a < order; a++) {
+      int i = (fy - order + 1 + a + mesh) % mesh;
+      for (int b = 0; b < order; b++) {
+        int j = (fx - order + 1 + b + mesh) % mesh;
+        m_grid[IDX2(i, j, mesh)] += q[c] * my[a] * mx[b];
+      }
+    }
+  }
+
+  transform(m_fft, m_grid, false);
+  tbb::parallel_for(tbb::blocked_range<int>(0, mesh * mesh), [&](const tbb::blocked_range<int>& r) {
+    for (int p = r.begin(); p < r.end(); p++) {
+      m_grid[p] *= m_influence[p];
+    }
+  });
+  transform(m_fft, m_grid, true);
+  m_phi.resize(mesh * mesh);
+  for (int p = 0; p < mesh * mesh; p++) {
+    m_phi[p] = m_grid[p].real();
+  }
+
+  // periodic cell list for the real-space sum
+  if (m_cells > 0) {
+    int cells = m_cells;
+    std::vector<int> cell(n);
+    m_cell_start.assign(cells * cells + 1, 0);
+    for (int c = 0; c < n; c++) {
+      int cx = std::min(int(m_x[c](0) * cells), cells - 1);
+      int cy = std::min(int(m_x[c](1) * cells), cells - 1);
+      cell[c] = IDX2(cy, cx, cells);
+      m_cell_start[cell[c] + 1]++;
+    }
+    for (int b = 0; b < cells * cells; b++) {
+      m_cell_start[b + 1] += m_cell_start[b];
+    }
+    m_members.resize(n);
+    std::vector<int> fill(m_cell_start.begin(), m_cell_start.end() - 1);
+    for (int c = 0; c < n; c++) {
+      m_members[fill[cell[c]]++] = c;
+    }
+  }
+}
+
+template <typename F>
+void EwaldPME::for_neighbours(const Vector2d& loc, F&& f) const {
+  double cutoff2 = m_cutoff * m_cutoff;
+  auto visit = [&](int j) {
+    Vector2d d = loc - m_x[j];
+    d(0) -= std::round(d(0));
+    d(1) -= std::round(d(1));
+    if (d.squaredNorm() < cutoff2) {
+      f(j, d);
+    }
+  };
+  if (m_cells == 0) {
+    for (int j = 0; j < int(m_x.size()); j++) {
+      visit(j);
+    }
+    return;
+  }
+  int cells = m_cells;
+  int cx = std::min(int(wrap_unit(loc(0)) * cells), cells - 1);
+  int cy = std::min(int(wrap_unit(loc(1)) * cells), cells - 1);
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      int c = IDX2(((cy + dy + cells) % cells), ((cx + dx + cells) % cells), cells);
+      for (int k = m_cell_start[c]; k < m_cell_start[c + 1]; k++) {
+        visit(m_members[k]);
+      }
+    }
+  }
+}
+
+double EwaldPME::mesh_potential(const Vector2d& loc, Vector2d* grad) const {
+  int mesh = m_mesh;
+  double ux = wrap_unit(loc(0)) * mesh;
+  double uy = wrap_unit(loc(1)) * mesh;
+  int fx = int(ux);
+  int fy = int(uy);
+  double mx[order], my[order], dmx[order], dmy[order];
+  bspline(ux - fx, mx, dmx);
+  bspline(uy - fy, my, dmy);
+  double phi = 0.0;
+  double gx = 0.0;
+  double gy = 0.0;
+  for (int a = 0; a < order; a++) {
+    int i = (fy - order + 1 + a + mesh) % mesh;
+    for (int b = 0; b < order; b++) {
+      int j = (fx - order + 1 + b + mesh) % mesh;
+      double v = m_phi[IDX2(i, j, mesh)];
+      phi += my[a] * mx[b] * v;
+      gx += my[a] * dmx[b] * v;
+      gy += dmy[a] * mx[b] * v;
+    }
+  }
+  if (grad) {
+    *grad = Vector2d(gx, gy) * mesh;
+  }
+  return phi;
+}
+
+double EwaldPME::potential_at(const Vector2d& loc) const {
+  double v = 0.0;
+  for_neighbours(loc, [&](int j, const Vector2d& d) {
+    double r = d.norm();
+    v += m_q[j] * std::erfc(m_alpha * r) / (r + eps);
+  });
+  v += mesh_potential(loc, nullptr) + m_background;
+  return k * v;
+}
+
+Vector2d EwaldPME::force(int i, double& phi) const {
+  const double two_over_sqrt_pi = 2.0 / std::sqrt(std::numbers::pi);
+  Vector2d f = Vector2d::Zero();
+  double v = 0.0;
+  for_neighbours(m_x[i], [&](int j, const Vector2d& d) {
+    if (j == i) {
+      return;
+    }
+    double r = d.norm();
+    double rs = r + eps;
+    double screened = std::erfc(m_alpha * r);
+    v += m_q[j] * screened / rs;
+    // two charges at the same place push each other in no direction
+    if (r > 0) {
+      double dpsi = two_over_sqrt_pi * m_alpha * std::exp(-m_alpha * m_alpha * r * r) / rs + screened / (rs * rs);
+      f += m_q[j] * dpsi / r * d;
+    }
+  });
+  Vector2d grad;
+  v += mesh_potential(m_x[i], &grad) - m_q[i] * m_self + m_background;
+  f -= grad;
+  phi = k * v;
+  return k * m_q[i] * f;
+}
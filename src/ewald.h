@@ -0,0 +1,76 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include "fft.h"
+#include "particle.h"
+
+/*
+ * Periodic electrostatics in the unit square by smooth particle-mesh Ewald
+ * (Essmann et al. 1995), for charges in the plane interacting in 1/r.
+ *
+ * The pair potential is split at the scale 1/alpha:
+ *
+ *   k q q' (erfc(alpha r) / (r + eps) + erf(alpha r) / r)
+ *
+ * The first term is short-range and summed directly over the pairs closer
+ * than the cutoff (nearest image, periodic cell list); the softening eps of
+ * the other engines is kept there. The second term is smooth; its periodic
+ * sum is computed in Fourier space on a K x K mesh: the charges are spread
+ * with cubic B-splines, the mesh is transformed, multiplied by the
+ * influence function 2 pi erfc(G / (2 alpha)) / G times the B-spline
+ * correction, and transformed back. Potentials and forces are interpolated
+ * from the mesh with the same splines. For a non-neutral system the
+ * divergent G = 0 term is dropped (uniform neutralizing background).
+ *
+ * The cutoff, alpha and the mesh size are chosen from the number of charges
+ * and the target relative accuracy: the cutoff keeps about 40 neighbours,
+ * erfc(alpha rc) and erfc(G_max / (2 alpha)) are both about the accuracy.
+ */
+class EwaldPME {
+public:
+  EwaldPME(int n, double accuracy);
+
+  // Spread the charges and solve the mesh for positions x (in the unit
+  // square) and charges q; must be called before the queries below
+  void update(const std::vector<Vector2d>& x, const std::vector<double>& q);
+
+  // Periodic potential at any point
+  double potential_at(const Vector2d& loc) const;
+
+  // Force on charge i and its potential energy per unit charge (without
+  // its own contribution)
+  Vector2d force(int i, double& phi) const;
+
+  // Image of x in the unit square
+  static Vector2d wrap(const Vector2d& x);
+
+  int m_charges;
+  double m_accuracy;
+  double m_cutoff;
+  double m_alpha;
+  int m_mesh;
+
+private:
+  // Sum of f(j, d) over the charges j within the cutoff of loc, d = loc - x[j]
+  // at the nearest image
+  template <typename F>
+  void for_neighbours(const Vector2d& loc, F&& f) const;
+
+  // Reciprocal potential and gradient at loc, interpolated from the mesh
+  double mesh_potential(const Vector2d& loc, Vector2d* grad) const;
+
+  double m_self;  // reciprocal potential of a unit charge at its own position
+  FFT m_fft;
+  std::vector<double> m_influence;  // influence function times B-spline correction
+  std::vector<std::complex<double>> m_grid;
+  std::vector<double> m_phi;  // reciprocal potential on the mesh
+  double m_background = 0.0;  // G = 0 term of a non-neutral system
+
+  std::vector<Vector2d> m_x;
+  std::vector<double> m_q;
+  int m_cells;  // periodic cells per side, 0 to test all the pairs
+  std::vector<int> m_cell_start;
+  std::vector<int> m_members;
+};
@@ -1,18 +1,24 @@
 #include "experiments.h"
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
 #include <random>
 
+#include "philox.h"
+
 void experiment_basic(std::vector<Particle>& particles) {
   const double delta = 0.01;
   particles.push_back(Particle({0.5 - delta, 0.5}, {0, 0}, 1));
   particles.push_back(Particle({0.5 + delta, 0.5}, {0, 0}, -1));
 }
 
-void experiment_random(int n, std::vector<Particle>& particles) {
-  std::mt19937 rnd(0);
+void experiment_random(int n, std::vector<Particle>& particles, std::uint64_t seed) {
+  std::mt19937 rnd{std::mt19937::result_type(seed)};
   double margin = 0.2;
   std::uniform_real_distribution<double> pos(0.0 + margin, 1.0 - margin);
   std::uniform_real_distribution<double> q(-1, 1);
+  particles.reserve(particles.size() + n);
   for (int i = 0; i < n; i++) {
     particles.push_back(Particle({pos(rnd), pos(rnd)}, {0, 0}, q(rnd)));
   }
@@ -26,7 +32,14 @@ void experiment_crystal(int n, std::vector<Particle>& particles) {
   double x2 = 0.7;
   double step = (x2 - x1) / (n - 1);
   double off = step / 2;
-  for (int i = 0; i < nrows; i++) {
+
+  // les lignes paires ont n - 1 particules, les impaires ncols: la position
+  // de chaque ligne est connue d'avance et les lignes sont remplies en
+  // parallèle
+  auto row_start = [&](int i) { return size_t((i + 1) / 2) * (n - 1) + size_t(i / 2) * ncols; };
+  size_t first = particles.size();
+  particles.resize(first + row_start(nrows), Particle({0, 0}, {0, 0}, 0));
+  tbb::parallel_for(0, nrows, [&](int i) {
     double y = x1 + i * step;
     double begin = 0.0;
     int cols = ncols;
@@ -35,10 +48,13 @@ void experiment_crystal(int n, std::vector<Particle>& particles) {
       begin = off;
       cols = n - 1;
     }
-    for (int j = 0; j < cols; j++) {
-      particles.push_back(Particle({x1 + begin + j * step, y}, {0, 0}, q));
-    }
-  }
+    size_t start = first + row_start(i);
+    tbb::parallel_for(tbb::blocked_range<int>(0, cols), [&](const tbb::blocked_range<int>& r) {
+      for (int j = r.begin(); j < r.end(); j++) {
+        particles[start + j] = Particle({x1 + begin + j * step, y}, {0, 0}, q);
+      }
+    });
+  });
 }
 
 void experiment_collision(int n, std::vector<Particle>& particles) {
@@ -46,10 +62,44 @@ void experiment_collision(int n, std::vector<Particle>& particles) {
   double step = 0.5 / (n - 1);
 
   // ----- >      < +++++
-  for (int i = 0; i < n; i++) {
-    Particle p({0.1 - i * step, 0.499}, {1e7, 0}, 10);
-    Particle n({0.9 + i * step, 0.501}, {-1e7, 0}, 10);
-    particles.push_back(p);
-    particles.push_back(n);
+  size_t first = particles.size();
+  particles.resize(first + 2 * size_t(n), Particle({0, 0}, {0, 0}, 0));
+  tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      particles[first + 2 * i] = Particle({0.1 - i * step, 0.499}, {1e7, 0}, 10);
+      particles[first + 2 * i + 1] = Particle({0.9 + i * step, 0.501}, {-1e7, 0}, 10);
+    }
+  });
+}
+
+void experiment_random_counter(int n, std::vector<Particle>& particles, std::uint64_t seed) {
+  // mêmes bornes que experiment_random
+  double margin = 0.2;
+  size_t first = particles.size();
+  particles.resize(first + n, Particle({0, 0}, {0, 0}, 0));
+  tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      // compteur (i, 0) pour la position, (i, 1) pour la charge
+      Philox4x32::Counter pos = Philox4x32::generate({std::uint32_t(i), 0, 0, 0}, seed);
+      Philox4x32::Counter charge = Philox4x32::generate({std::uint32_t(i), 1, 0, 0}, seed);
+      double x = margin + (1.0 - 2 * margin) * Philox4x32::uniform(pos[0], pos[1]);
+      double y = margin + (1.0 - 2 * margin) * Philox4x32::uniform(pos[2], pos[3]);
+      double q = -1.0 + 2.0 * Philox4x32::uniform(charge[0], charge[1]);
+      particles[first + i] = Particle({x, y}, {0, 0}, q);
+    }
+  });
+}
+
+void make_experiment(int id, int n, std::uint64_t seed, std::vector<Particle>& particles) {
+  if (id == 0) {
+    experiment_random(n, particles, seed);
+  } else if (id == 1) {
+    experiment_crystal(n, particles);
+  } else if (id == 2) {
+    experiment_collision(n, particles);
+  } else if (id == 3) {
+    experiment_basic(particles);
+  } else if (id == 4) {
+    experiment_random_counter(n, particles, seed);
   }
 }
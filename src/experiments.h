@@ -1,8 +1,22 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include "particle.h"
 
 void experiment_basic(std::vector<Particle>& particles);
-void experiment_random(int n, std::vector<Particle>& particles);
+// Positions et charges tirées d'un mt19937 initialisé avec `seed`, en série
+void experiment_random(int n, std::vector<Particle>& particles, std::uint64_t seed = 0);
 void experiment_crystal(int n, std::vector<Particle>& particles);
 void experiment_collision(int n, std::vector<Particle>& particles);
+
+// Comme experiment_random, mais chaque particule est tirée d'un générateur
+// à compteur (Philox) à partir de son indice et de `seed`: généré en
+// parallèle, avec le même résultat quel que soit le nombre de fils.
+void experiment_random_counter(int n, std::vector<Particle>& particles, std::uint64_t seed);
+
+// Générer l'expérience `id` (option -e): 0 aléatoire, 1 cristal,
+// 2 collision, 3 deux charges, 4 aléatoire à compteur. Seules 0 et 4
+// dépendent de `seed`.
+void make_experiment(int id, int n, std::uint64_t seed, std::vector<Particle>& particles);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <complex>
+#include <numbers>
+#include <vector>
+
+/*
+ * Minimal in-place radix-2 FFT (Cooley-Tukey, iterative).
+ *
+ * The size must be a power of two. The bit-reversal table and the roots
+ * of unity are computed once, transform() only reads them and can be
+ * called concurrently on different arrays. The inverse transform is not
+ * normalized: inverse(forward(a)) == n * a.
+ */
+class FFT {
+public:
+  explicit FFT(int n) : m_n(n), m_rev(n), m_roots(n / 2) {
+    int bits = 0;
+    while ((1 << bits) < n) {
+      bits++;
+    }
+    for (int i = 0; i < n; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      m_rev[i] = r;
+    }
+    for (int i = 0; i < n / 2; i++) {
+      double angle = -2.0 * std::numbers::pi * i / n;
+      m_roots[i] = std::complex<double>(std::cos(angle), std::sin(angle));
+    }
+  }
+
+  void transform(std::complex<double>* a, bool inverse) const {
+    for (int i = 0; i < m_n; i++) {
+      if (i < m_rev[i]) {
+        std::swap(a[i], a[m_rev[i]]);
+      }
+    }
+    for (int len = 2; len <= m_n; len <<= 1) {
+      int half = len / 2;
+      int step = m_n / len;
+      for (int i = 0; i < m_n; i += len) {
+        for (int j = 0; j < half; j++) {
+          std::complex<double> w = inverse ? std::conj(m_roots[j * step]) : m_roots[j * step];
+          std::complex<double> u = a[i + j];
+          std::complex<double> v = a[i + j + half] * w;
+          a[i + j] = u + v;
+          a[i + j + half] = u - v;
+        }
+      }
+    }
+  }
+
+  int size() const {
+    return m_n;
+  }
+
+  // Smallest power of two greater than or equal to n
+  static int next_pow2(int n) {
+    int p = 1;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+private:
+  int m_n;
+  std::vector<int> m_rev;
+  std::vector<std::complex<double>> m_roots;
+};
@@ -0,0 +1,324 @@
+#include "fieldio.h"
+
+#include <tbb/parallel_for.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+void write_raw_field(std::ostream& ofs, int width, int height, const std::vector<const double*>& components) {
+  std::int32_t header[3] = {width, height, std::int32_t(components.size())};
+  ofs.write("FLD1", 4);
+  ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  // interleave the components one row at a time
+  int nc = components.size();
+  std::vector<double> row(width * nc);
+  for (int i = 0; i < height; i++) {
+    for (int j = 0; j < width; j++) {
+      for (int c = 0; c < nc; c++) {
+        row[j * nc + c] = components[c][i * width + j];
+      }
+    }
+    ofs.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(double));
+  }
+}
+
+bool read_raw_field(std::istream& ifs, int& width, int& height, std::vector<std::vector<double>>& components) {
+  char magic[4];
+  std::int32_t header[3];
+  ifs.read(magic, 4);
+  ifs.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!ifs || std::string_view(magic, 4) != "FLD1" || header[0] < 0 || header[1] < 0 || header[2] < 1) {
+    return false;
+  }
+  width = header[0];
+  height = header[1];
+  int nc = header[2];
+
+  std::vector<double> row(width * nc);
+  components.assign(nc, std::vector<double>(width * height));
+  for (int i = 0; i < height; i++) {
+    ifs.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(double));
+    for (int j = 0; j < width; j++) {
+      for (int c = 0; c < nc; c++) {
+        components[c][i * width + j] = row[j * nc + c];
+      }
+    }
+  }
+  return bool(ifs);
+}
+
+namespace {
+
+// Round the float64 word u to 52 - drop bits of mantissa; the carry may
+// go into the exponent, as in any rounding. Infinities and NaNs are kept.
+std::uint64_t round_mantissa(std::uint64_t u, int drop) {
+  if (drop == 0 || ((u >> 52) & 0x7ff) == 0x7ff) {
+    return u;
+  }
+  std::uint64_t half = std::uint64_t(1) << (drop - 1);
+  return (u + half) & ~((half << 1) - 1);
+}
+
+// Signed difference of two words, small differences of either sign to
+// small values (zigzag), and back
+std::uint64_t encode_delta(std::uint64_t u, std::uint64_t ref) {
+  std::uint64_t d = u - ref;
+  return (d << 1) ^ std::uint64_t(std::int64_t(d) >> 63);
+}
+
+std::uint64_t decode_delta(std::uint64_t z, std::uint64_t ref) {
+  return ref + ((z >> 1) ^ (~(z & 1) + 1));
+}
+
+}  // namespace
+
+bool is_field_store(const std::string& path) {
+  return std::filesystem::path(path).extension() == ".fldz";
+}
+
+std::string field_store_path(const std::string& path, int first) {
+  if (first == 0) {
+    return path;
+  }
+  std::filesystem::path p(path);
+  std::ostringstream name;
+  name << p.stem().string() << "-" << std::setw(6) << std::setfill('0') << first << p.extension().string();
+  return (p.parent_path() / name.str()).string();
+}
+
+FieldStore::FieldStore(std::ostream& ofs, const FieldStoreOptions& opt, int first)
+    : m_ofs(ofs), m_opt(opt), m_first(first) {
+  if (opt.keyframe < 1 || opt.mantissa_bits < 0 || opt.mantissa_bits > 52 ||
+      opt.block < 1) {
+    throw std::runtime_error("field store options out of range");
+  }
+}
+
+void FieldStore::write(int width, int height, const std::vector<const double*>& components) {
+  if (m_written == 0) {
+    m_width = width;
+    m_height = height;
+    m_components = components.size();
+    std::int32_t header[7] = {width, height, m_components, m_opt.block, m_opt.keyframe, m_opt.mantissa_bits, m_first};
+    std::int64_t index = 0;
+    std::int32_t frames = 0;
+    m_start = m_ofs.tellp();
+    m_ofs.write("FLZ1", 4);
+    m_ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+    m_ofs.write(reinterpret_cast<const char*>(&index), sizeof(index));
+    m_ofs.write(reinterpret_cast<const char*>(&frames), sizeof(frames));
+    m_end = 4 + sizeof(header) + sizeof(index) + sizeof(frames);
+  } else if (width != m_width || height != m_height || int(components.size()) != m_components) {
+    throw std::runtime_error("field store: the frame size changed");
+  }
+
+  int plane = width * height;
+  int per_plane = (plane + m_opt.block - 1) / m_opt.block;
+  int blocks = m_components * per_plane;
+  int drop = 52 - m_opt.mantissa_bits;
+  bool key = m_written % m_opt.keyframe == 0;
+  std::vector<std::uint64_t> current(std::size_t(m_components) * plane);
+  std::vector<std::vector<std::uint8_t>> deflated(blocks);
+
+  tbb::parallel_for(0, blocks, [&](int b) {
+    int c = b / per_plane;
+    int begin = (b % per_plane) * m_opt.block;
+    int n = std::min(m_opt.block, plane - begin);
+    const double* v = components[c] + begin;
+    std::uint64_t* words = &current[std::size_t(c) * plane + begin];
+    const std::uint64_t* previous = key ? nullptr : &m_previous[std::size_t(c) * plane + begin];
+
+    // delta, then byte planes
+    std::vector<std::uint8_t> shuffled(8 * std::size_t(n));
+    for (int i = 0; i < n; i++) {
+      words[i] = round_mantissa(std::bit_cast<std::uint64_t>(v[i]), drop);
+      std::uint64_t d = encode_delta(words[i], previous ? previous[i] : i > 0 ? words[i - 1] : 0);
+      for (int k = 0; k < 8; k++) {
+        shuffled[std::size_t(k) * n + i] = std::uint8_t(d >> (8 * k));
+      }
+    }
+
+    // run-length matches only: the planes are runs of zeros and nearly
+    // random bytes, a longer match search finds little more for twice the
+    // time
+    z_stream z = {};
+    if (deflateInit2(&z, 1, Z_DEFLATED, 15, 8, Z_RLE) != Z_OK) {
+      throw std::runtime_error("zlib compression failed");
+    }
+    deflated[b].resize(deflateBound(&z, shuffled.size()));
+    z.next_in = shuffled.data();
+    z.avail_in = shuffled.size();
+    z.next_out = deflated[b].data();
+    z.avail_out = deflated[b].size();
+    int status = deflate(&z, Z_FINISH);
+    deflated[b].resize(z.total_out);
+    deflateEnd(&z);
+    if (status != Z_STREAM_END) {
+      throw std::runtime_error("zlib compression failed");
+    }
+  });
+
+  m_offsets.push_back(m_end);
+  for (const std::vector<std::uint8_t>& d : deflated) {
+    m_ofs.write(reinterpret_cast<const char*>(d.data()), d.size());
+    m_sizes.push_back(d.size());
+    m_end += d.size();
+  }
+  m_previous.swap(current);
+  m_written++;
+}
+
+void FieldStore::write_index() {
+  if (m_written == 0) {
+    return;
+  }
+  std::int64_t index = m_end;
+  int blocks = m_sizes.size() / m_written;
+  for (int f = 0; f < m_written; f++) {
+    m_ofs.write(reinterpret_cast<const char*>(&m_offsets[f]), sizeof(std::int64_t));
+    m_ofs.write(reinterpret_cast<const char*>(&m_sizes[std::size_t(f) * blocks]), blocks * sizeof(std::uint32_t));
+  }
+  std::int32_t frames = m_written;
+  m_ofs.write(reinterpret_cast<const char*>(&index), sizeof(index));
+  m_ofs.write(reinterpret_cast<const char*>(&frames), sizeof(frames));
+  m_ofs.write("FLZI", 4);
+  m_ofs.flush();
+  // the next frame goes after this trailer
+  m_end += std::int64_t(m_written) * (sizeof(std::int64_t) + blocks * sizeof(std::uint32_t)) + 16;
+
+  // only now that the index is complete, point the header at it
+  m_ofs.seekp(m_start + std::streamoff(4 + 7 * sizeof(std::int32_t)));
+  m_ofs.write(reinterpret_cast<const char*>(&index), sizeof(index));
+  m_ofs.write(reinterpret_cast<const char*>(&frames), sizeof(frames));
+  m_ofs.seekp(m_start + std::streamoff(m_end));
+  m_ofs.flush();
+}
+
+void FieldStore::finish() {
+  write_index();
+}
+
+bool FieldStoreReader::open(std::istream& ifs) {
+  m_ifs = &ifs;
+  m_current = -1;
+  std::streamoff base = ifs.tellg();
+  char magic[4];
+  std::int32_t header[7];
+  ifs.read(magic, 4);
+  ifs.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!ifs || std::string_view(magic, 4) != "FLZ1" || header[0] < 0 || header[1] < 0 || header[2] < 1 ||
+      header[3] < 1 || header[4] < 1 || header[5] < 0 || header[5] > 52) {
+    return false;
+  }
+  m_width = header[0];
+  m_height = header[1];
+  m_components = header[2];
+  m_opt.block = header[3];
+  m_opt.keyframe = header[4];
+  m_opt.mantissa_bits = header[5];
+  m_first = header[6];
+
+  // the header points at the last complete index, which is followed by
+  // its trailer
+  std::int64_t index;
+  std::int32_t frames;
+  ifs.read(reinterpret_cast<char*>(&index), sizeof(index));
+  ifs.read(reinterpret_cast<char*>(&frames), sizeof(frames));
+  if (!ifs || index <= 0 || frames <= 0) {
+    return false;
+  }
+
+  std::int64_t plane = std::int64_t(m_width) * m_height;
+  int blocks = m_components * ((plane + m_opt.block - 1) / m_opt.block);
+  m_offsets.resize(frames);
+  m_sizes.resize(std::size_t(frames) * blocks);
+  ifs.seekg(base + index);
+  for (int f = 0; f < frames; f++) {
+    ifs.read(reinterpret_cast<char*>(&m_offsets[f]), sizeof(std::int64_t));
+    ifs.read(reinterpret_cast<char*>(&m_sizes[std::size_t(f) * blocks]), blocks * sizeof(std::uint32_t));
+    m_offsets[f] += base;
+  }
+  std::int64_t trailer_index;
+  std::int32_t trailer_frames;
+  ifs.read(reinterpret_cast<char*>(&trailer_index), sizeof(trailer_index));
+  ifs.read(reinterpret_cast<char*>(&trailer_frames), sizeof(trailer_frames));
+  ifs.read(magic, 4);
+  if (!ifs || std::string_view(magic, 4) != "FLZI" || trailer_index != index || trailer_frames != frames) {
+    return false;
+  }
+  m_words.resize(std::size_t(m_components) * plane);
+  return bool(ifs);
+}
+
+bool FieldStoreReader::decode(int f) {
+  int plane = m_width * m_height;
+  int per_plane = (plane + m_opt.block - 1) / m_opt.block;
+  int blocks = m_components * per_plane;
+  const std::uint32_t* sizes = &m_sizes[std::size_t(f) * blocks];
+  std::vector<std::size_t> starts(blocks + 1, 0);
+  std::inclusive_scan(sizes, sizes + blocks, starts.begin() + 1, std::plus<std::size_t>());
+  std::vector<std::uint8_t> deflated(starts[blocks]);
+  m_ifs->seekg(m_offsets[f]);
+  m_ifs->read(reinterpret_cast<char*>(deflated.data()), deflated.size());
+  if (!*m_ifs) {
+    return false;
+  }
+
+  bool key = f % m_opt.keyframe == 0;
+  std::vector<char> ok(blocks, 1);
+  tbb::parallel_for(0, blocks, [&](int b) {
+    int c = b / per_plane;
+    int begin = (b % per_plane) * m_opt.block;
+    int n = std::min(m_opt.block, plane - begin);
+    std::uint64_t* words = &m_words[std::size_t(c) * plane + begin];
+
+    std::vector<std::uint8_t> shuffled(8 * std::size_t(n));
+    uLongf size = shuffled.size();
+    if (uncompress(shuffled.data(), &size, &deflated[starts[b]], sizes[b]) != Z_OK || size != shuffled.size()) {
+      ok[b] = 0;
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      std::uint64_t d = 0;
+      for (int k = 0; k < 8; k++) {
+        d |= std::uint64_t(shuffled[std::size_t(k) * n + i]) << (8 * k);
+      }
+      words[i] = decode_delta(d, key ? (i > 0 ? words[i - 1] : 0) : words[i]);
+    }
+  });
+  m_current = std::find(ok.begin(), ok.end(), 0) == ok.end() ? f : -1;
+  return m_current == f;
+}
+
+bool FieldStoreReader::read(int f, std::vector<std::vector<double>>& components) {
+  if (!m_ifs || f < 0 || f >= frames()) {
+    return false;
+  }
+  // from the key frame, or from the frame already decoded
+  int start = f - f % m_opt.keyframe;
+  if (m_current >= start && m_current <= f) {
+    start = m_current + 1;
+  }
+  for (int g = start; g <= f; g++) {
+    if (!decode(g)) {
+      return false;
+    }
+  }
+
+  std::size_t plane = std::size_t(m_width) * m_height;
+  components.assign(m_components, std::vector<double>(plane));
+  for (int c = 0; c < m_components; c++) {
+    for (std::size_t p = 0; p < plane; p++) {
+      components[c][p] = std::bit_cast<double>(m_words[c * plane + p]);
+    }
+  }
+  return true;
+}
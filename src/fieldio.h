@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Raw field dump.
+ *
+ * Little-endian binary file:
+ *
+ *   char     magic[4]    "FLD1"
+ *   int32    width
+ *   int32    height
+ *   int32    components  1 (potential) or 3 (potential, Ex, Ey)
+ *   float64  data[height][width][components]
+ *
+ * Row i of the data is y = i / height, as in m_sol (not flipped like the
+ * images).
+ */
+void write_raw_field(std::ostream& ofs, int width, int height, const std::vector<const double*>& components);
+
+// Read a dump written by write_raw_field, one vector per component. Returns
+// false if the stream is not a raw field.
+bool read_raw_field(std::istream& ifs, int& width, int& height, std::vector<std::vector<double>>& components);
+
+/*
+ * Compressed store of all the frames of a run, for the .fldz extension of
+ * the raw output template.
+ *
+ * Each component is stored planar and split in blocks of `block` values.
+ * The float64 words of a block are:
+ *
+ *   - rounded to `mantissa_bits` bits of mantissa (52: lossless),
+ *   - replaced by their difference, as 64-bit integers, with the same
+ *     word of the previous frame, or for key frames with the previous word
+ *     of the block, zigzag coded (0, -1, 1, -2... become 0, 1, 2, 3...):
+ *     close values of the same sign have close bit patterns, and their
+ *     difference has mostly zero high bytes,
+ *   - byte shuffled: the 8 bytes of each word go to 8 planes, so the zeros
+ *     of the high bytes line up in long runs (as in Blosc),
+ *   - deflated by zlib with run-length matches only, all the blocks of a
+ *     frame in parallel.
+ *
+ * Little-endian file:
+ *
+ *   char     magic[4]    "FLZ1"
+ *   int32    width, height, components, block, keyframe, mantissa_bits
+ *   int32    first       iteration of frame 0
+ *   int64    offset of the last index written, 0 before the first
+ *   int32    frames of the last index written
+ *   frames   the deflated blocks of each frame, one after the other
+ *   index    per frame: int64 offset, then uint32 size of each block
+ *   int64    offset of the index
+ *   int32    frames
+ *   char     magic[4]    "FLZI"
+ *
+ * The index makes any frame readable without scanning the file: decoding
+ * starts at the key frame before it (every `keyframe` frames). The index
+ * is written by finish(), so the store must go to a seekable file.
+ *
+ * write_index() writes an index and trailer for the frames so far and
+ * keeps going: later frames follow it. The header is then updated to point
+ * at this index, and the reader follows the header, so a store cut short
+ * after such a point still opens, with the frames it covered.
+ */
+struct FieldStoreOptions {
+  int keyframe = 32;       // frames between key frames
+  int mantissa_bits = 52;  // mantissa bits kept, 0 to 52
+  int block = 1 << 16;     // values per compressed block
+};
+
+// The raw output template is a compressed store (.fldz)
+bool is_field_store(const std::string& path);
+
+// File of a store whose frame 0 is iteration `first`: the path itself for
+// 0, otherwise "-" and the iteration before the extension
+// (champs.fldz -> champs-000041.fldz)
+std::string field_store_path(const std::string& path, int first);
+
+class FieldStore {
+public:
+  FieldStore(std::ostream& ofs, const FieldStoreOptions& opt, int first);
+
+  // Append a frame; the size and number of components are those of the
+  // first frame
+  void write(int width, int height, const std::vector<const double*>& components);
+
+  // Write the index and the trailer of the frames so far; writing may go on
+  void write_index();
+
+  // Write the index and the trailer
+  void finish();
+
+  int m_written = 0;
+
+private:
+  std::ostream& m_ofs;
+  FieldStoreOptions m_opt;
+  int m_first;
+  int m_width = 0;
+  int m_height = 0;
+  int m_components = 0;
+  std::vector<std::uint64_t> m_previous;  // rounded words of the previous frame
+  std::vector<std::int64_t> m_offsets;    // start of each frame
+  std::int64_t m_end = 0;                 // bytes written so far
+  std::streampos m_start;                 // position of the magic in the stream
+  std::vector<std::uint32_t> m_sizes;  // block sizes, frame after frame
+};
+
+class FieldStoreReader {
+public:
+  // Read the header and the index. Returns false if the stream is not a
+  // complete store.
+  bool open(std::istream& ifs);
+
+  int frames() const {
+    return m_offsets.size();
+  }
+
+  // Frame f, one vector per component; consecutive frames only decode the
+  // new one
+  bool read(int f, std::vector<std::vector<double>>& components);
+
+  int m_width = 0;
+  int m_height = 0;
+  int m_components = 0;
+  int m_first = 0;
+  FieldStoreOptions m_opt;
+
+private:
+  // Decode frame f over m_words, which must hold frame f - 1 unless f is a
+  // key frame
+  bool decode(int f);
+
+  std::istream* m_ifs = nullptr;
+  std::vector<std::int64_t> m_offsets;
+  std::vector<std::uint32_t> m_sizes;
+  std::vector<std::uint64_t> m_words;
+  int m_current = -1;  // frame in m_words
+};
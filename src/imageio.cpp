@@ -0,0 +1,544 @@
+#include "imageio.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+std::string stream_path(const std::string& path, int first) {
+  if (path == "-") {
+    return "/dev/stdout";
+  }
+  if (first == 0 || std::filesystem::is_fifo(path)) {
+    return path;
+  }
+  std::filesystem::path p(path);
+  std::ostringstream name;
+  name << p.stem().string() << "-" << std::setw(6) << std::setfill('0') << first << p.extension().string();
+  return (p.parent_path() / name.str()).string();
+}
+
+ImageFormat image_format(const std::string& path) {
+  std::string ext = std::filesystem::path(path).extension().string();
+  if (ext == ".ppm") {
+    return ImageFormat::PPM;
+  }
+  if (ext == ".qoi") {
+    return ImageFormat::QOI;
+  }
+  if (ext == ".y4m" || path == "-") {
+    return ImageFormat::Y4M;
+  }
+  if (ext == ".apng") {
+    return ImageFormat::APNG;
+  }
+  return ImageFormat::PNG;
+}
+
+void write_image(std::ostream& ofs, const png::image<png::rgb_pixel>& img, const ImageOptions& opt) {
+  switch (opt.format) {
+    case ImageFormat::PPM:
+      write_ppm(ofs, img);
+      break;
+    case ImageFormat::QOI:
+      write_qoi(ofs, img);
+      break;
+    case ImageFormat::Y4M:
+    case ImageFormat::APNG: {
+      // a stream of one frame
+      FrameStream stream(ofs, opt, 1);
+      stream.write(img);
+      stream.finish();
+      break;
+    }
+    default:
+      write_png(ofs, img, opt.png_level, opt.png_filter);
+      break;
+  }
+}
+
+void write_ppm(std::ostream& ofs, const png::image<png::rgb_pixel>& img) {
+  int w = img.get_width();
+  int h = img.get_height();
+  std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+  std::vector<char> buf(header.size() + 3L * w * h);
+  std::copy(header.begin(), header.end(), buf.begin());
+  char* out = buf.data() + header.size();
+  for (int i = 0; i < h; i++) {
+    for (const png::rgb_pixel& p : img.get_row(i)) {
+      *out++ = p.red;
+      *out++ = p.green;
+      *out++ = p.blue;
+    }
+  }
+  ofs.write(buf.data(), buf.size());
+}
+
+namespace {
+
+struct Rgba {
+  std::uint8_t r, g, b, a;
+
+  bool operator==(const Rgba&) const = default;
+};
+
+void put32(std::vector<std::uint8_t>& out, std::uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+}  // namespace
+
+void write_qoi(std::ostream& ofs, const png::image<png::rgb_pixel>& img) {
+  int w = img.get_width();
+  int h = img.get_height();
+  std::vector<std::uint8_t> out;
+  out.reserve(14 + 4L * w * h + 8);
+  out.insert(out.end(), {'q', 'o', 'i', 'f'});
+  put32(out, w);
+  put32(out, h);
+  out.push_back(3);  // channels
+  out.push_back(0);  // sRGB
+
+  Rgba index[64] = {};
+  Rgba prev{0, 0, 0, 255};
+  int run = 0;
+  long last = 1L * w * h - 1;
+  long pos = 0;
+  for (int i = 0; i < h; i++) {
+    for (const png::rgb_pixel& p : img.get_row(i)) {
+      Rgba px{p.red, p.green, p.blue, 255};
+      if (px == prev) {
+        run++;
+        if (run == 62 || pos == last) {
+          out.push_back(0xc0 | (run - 1));  // QOI_OP_RUN
+          run = 0;
+        }
+        pos++;
+        continue;
+      }
+      if (run > 0) {
+        out.push_back(0xc0 | (run - 1));
+        run = 0;
+      }
+      int hash = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+      if (index[hash] == px) {
+        out.push_back(hash);  // QOI_OP_INDEX
+      } else {
+        index[hash] = px;
+        // differences wrap around, as in the decoder
+        std::int8_t dr = px.r - prev.r;
+        std::int8_t dg = px.g - prev.g;
+        std::int8_t db = px.b - prev.b;
+        std::int8_t dr_dg = dr - dg;
+        std::int8_t db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+          out.push_back(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));  // QOI_OP_DIFF
+        } else if (dr_dg >= -8 && dr_dg <= 7 && dg >= -32 && dg <= 31 && db_dg >= -8 && db_dg <= 7) {
+          out.push_back(0x80 | (dg + 32));  // QOI_OP_LUMA
+          out.push_back(((dr_dg + 8) << 4) | (db_dg + 8));
+        } else {
+          out.insert(out.end(), {0xfe, px.r, px.g, px.b});  // QOI_OP_RGB
+        }
+      }
+      prev = px;
+      pos++;
+    }
+  }
+  out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+  ofs.write(reinterpret_cast<const char*>(out.data()), out.size());
+}
+
+void write_png(std::ostream& ofs, const png::image<png::rgb_pixel>& img, int level, int filter) {
+  static const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH,
+                                PNG_ALL_FILTERS};
+  if (filter > 5 || level > 9) {
+    throw std::runtime_error("png level or filter out of range");
+  }
+  png::writer<std::ostream> writer(ofs);
+  writer.set_image_info(png::make_image_info<png::rgb_pixel>());
+  writer.set_width(img.get_width());
+  writer.set_height(img.get_height());
+  if (level >= 0) {
+    png_set_compression_level(writer.get_png_struct(), level);
+  }
+  if (filter >= 0) {
+    png_set_filter(writer.get_png_struct(), PNG_FILTER_TYPE_BASE, filters[filter]);
+  }
+  writer.write_info();
+  for (size_t i = 0; i < img.get_height(); i++) {
+    // libpng does not modify the row it writes
+    auto* row = const_cast<png::rgb_pixel*>(img.get_row(i).data());
+    writer.write_row(reinterpret_cast<png::byte*>(row));
+  }
+  writer.write_end_info();
+}
+
+namespace {
+
+// Planar copy of a packed RGB row. The conversion loops below then read
+// with unit strides, have no branches and only integer arithmetic, so the
+// compiler vectorizes them even for SSE2; the de-interleave itself only
+// vectorizes with byte shuffles (SSSE3 and up, POTENTIAL_NATIVE_ARCH).
+struct PlanarRow {
+  std::vector<std::int16_t> r, g, b;
+
+  explicit PlanarRow(int w) : r(w), g(w), b(w) {
+  }
+
+  void load(const png::rgb_pixel* p, int w) {
+    auto* bytes = reinterpret_cast<const std::uint8_t*>(p);
+    for (int j = 0; j < w; j++) {
+      r[j] = bytes[3 * j];
+      g[j] = bytes[3 * j + 1];
+      b[j] = bytes[3 * j + 2];
+    }
+  }
+};
+
+// BT.601, limited range, 8-bit fixed point
+void luma_row(const PlanarRow& p, std::uint8_t* y, int w) {
+  const std::int16_t* r = p.r.data();
+  const std::int16_t* g = p.g.data();
+  const std::int16_t* b = p.b.data();
+  for (int j = 0; j < w; j++) {
+    y[j] = ((66 * r[j] + 129 * g[j] + 25 * b[j] + 128) >> 8) + 16;
+  }
+}
+
+// Chroma of the 2x2 blocks of rows p0 and p1, from the sums of the 4
+// pixels; sum holds the vertical sums of one channel at a time
+void chroma_row(const PlanarRow& p0, const PlanarRow& p1, PlanarRow& sum, std::uint8_t* u, std::uint8_t* v, int w) {
+  int cw = (w + 1) / 2;
+  for (auto [a, b, s] : {std::tie(p0.r, p1.r, sum.r), std::tie(p0.g, p1.g, sum.g), std::tie(p0.b, p1.b, sum.b)}) {
+    for (int j = 0; j < w; j++) {
+      s[j] = a[j] + b[j];
+    }
+  }
+  const std::int16_t* r = sum.r.data();
+  const std::int16_t* g = sum.g.data();
+  const std::int16_t* b = sum.b.data();
+  auto chroma = [&](int c, int rr, int gg, int bb) {
+    u[c] = ((-38 * rr - 74 * gg + 112 * bb + 512) >> 10) + 128;
+    v[c] = ((112 * rr - 94 * gg - 18 * bb + 512) >> 10) + 128;
+  };
+  int pairs = w / 2;
+  for (int c = 0; c < pairs; c++) {
+    chroma(c, r[2 * c] + r[2 * c + 1], g[2 * c] + g[2 * c + 1], b[2 * c] + b[2 * c + 1]);
+  }
+  if (pairs < cw) {
+    // last column of an odd width: its pixels count twice
+    chroma(pairs, 2 * r[w - 1], 2 * g[w - 1], 2 * b[w - 1]);
+  }
+}
+
+}  // namespace
+
+void rgb_to_yuv420(const png::image<png::rgb_pixel>& img, std::uint8_t* y, std::uint8_t* u, std::uint8_t* v) {
+  static_assert(sizeof(png::rgb_pixel) == 3, "rows must be packed RGB bytes");
+  int w = img.get_width();
+  int h = img.get_height();
+  int cw = (w + 1) / 2;
+  int ch = (h + 1) / 2;
+  // one task per pair of rows: they share their chroma row
+  tbb::parallel_for(tbb::blocked_range<int>(0, ch), [&](const tbb::blocked_range<int>& r) {
+    PlanarRow p0(w), p1(w), sum(w);
+    for (int ci = r.begin(); ci < r.end(); ci++) {
+      int i0 = 2 * ci;
+      int i1 = std::min(i0 + 1, h - 1);
+      p0.load(img.get_row(i0).data(), w);
+      p1.load(img.get_row(i1).data(), w);
+      luma_row(p0, y + 1L * i0 * w, w);
+      if (i1 != i0) {
+        luma_row(p1, y + 1L * i1 * w, w);
+      }
+      chroma_row(p0, p1, sum, u + 1L * ci * cw, v + 1L * ci * cw, w);
+    }
+  });
+}
+
+void write_y4m(std::ostream& ofs, const png::image<png::rgb_pixel>& img, int fps, bool header) {
+  int w = img.get_width();
+  int h = img.get_height();
+  long luma = 1L * w * h;
+  long chroma = 1L * ((w + 1) / 2) * ((h + 1) / 2);
+  if (header) {
+    ofs << "YUV4MPEG2 W" << w << " H" << h << " F" << fps << ":1 Ip A1:1 C420jpeg\n";
+  }
+  std::vector<std::uint8_t> frame(luma + 2 * chroma);
+  rgb_to_yuv420(img, frame.data(), frame.data() + luma, frame.data() + luma + chroma);
+  ofs.write("FRAME\n", 6);
+  ofs.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+}
+
+Rect Rect::unite(const Rect& o) const {
+  if (empty()) {
+    return o;
+  }
+  if (o.empty()) {
+    return *this;
+  }
+  return Rect{std::min(x0, o.x0), std::min(y0, o.y0), std::max(x1, o.x1), std::max(y1, o.y1)};
+}
+
+Rect changed_rect(const png::image<png::rgb_pixel>& a, const png::image<png::rgb_pixel>& b) {
+  int w = a.get_width();
+  int h = a.get_height();
+  return tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, h), Rect(),
+      [&](const tbb::blocked_range<int>& r, Rect rect) {
+        for (int i = r.begin(); i < r.end(); i++) {
+          const png::rgb_pixel* pa = a.get_row(i).data();
+          const png::rgb_pixel* pb = b.get_row(i).data();
+          if (std::memcmp(pa, pb, 3L * w) == 0) {
+            continue;
+          }
+          auto same = [&](int j) { return std::memcmp(pa + j, pb + j, 3) == 0; };
+          int first = 0;
+          while (same(first)) {
+            first++;
+          }
+          int last = w - 1;
+          while (same(last)) {
+            last--;
+          }
+          rect = rect.unite(Rect{first, i, last + 1, i + 1});
+        }
+        return rect;
+      },
+      [](const Rect& x, const Rect& y) { return x.unite(y); });
+}
+
+namespace {
+
+void put16(std::vector<std::uint8_t>& out, std::uint16_t v) {
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a);
+  int pb = std::abs(p - b);
+  int pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+// PNG filter `type` (0 to 4) of row cur over row prev (zeros for the first
+// row), n bytes of 4-byte RGBA pixels. One loop per type, so that none,
+// sub, up and average vectorize.
+void filter_row(int type, const std::uint8_t* cur, const std::uint8_t* prev, int n, std::uint8_t* out) {
+  const int bpp = 4;
+  int head = std::min(bpp, n);
+  switch (type) {
+    case 0:
+      std::copy(cur, cur + n, out);
+      break;
+    case 1:
+      std::copy(cur, cur + head, out);
+      for (int k = bpp; k < n; k++) {
+        out[k] = cur[k] - cur[k - bpp];
+      }
+      break;
+    case 2:
+      for (int k = 0; k < n; k++) {
+        out[k] = cur[k] - prev[k];
+      }
+      break;
+    case 3:
+      for (int k = 0; k < head; k++) {
+        out[k] = cur[k] - prev[k] / 2;
+      }
+      for (int k = bpp; k < n; k++) {
+        out[k] = cur[k] - (cur[k - bpp] + prev[k]) / 2;
+      }
+      break;
+    default:
+      for (int k = 0; k < head; k++) {
+        out[k] = cur[k] - prev[k];  // Paeth of (0, up, 0) is up
+      }
+      for (int k = bpp; k < n; k++) {
+        out[k] = cur[k] - paeth(cur[k - bpp], prev[k], prev[k - bpp]);
+      }
+      break;
+  }
+}
+
+// Sum of the filtered bytes as signed values, the usual heuristic of the
+// adaptive filter
+long filter_cost(const std::uint8_t* out, int n) {
+  long cost = 0;
+  for (int k = 0; k < n; k++) {
+    cost += std::abs(int(std::int8_t(out[k])));
+  }
+  return cost;
+}
+
+}  // namespace
+
+FrameStream::FrameStream(std::ostream& ofs, const ImageOptions& opt, int frames)
+    : m_ofs(ofs), m_opt(opt), m_frames(frames) {
+}
+
+void FrameStream::write_chunk(const char* type, const std::vector<std::uint8_t>& data) {
+  std::vector<std::uint8_t> head;
+  put32(head, data.size());
+  head.insert(head.end(), type, type + 4);
+  uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+  if (!data.empty()) {
+    // a null buffer would reset the crc
+    crc = crc32(crc, data.data(), data.size());
+  }
+  std::vector<std::uint8_t> tail;
+  put32(tail, crc);
+  m_ofs.write(reinterpret_cast<const char*>(head.data()), head.size());
+  m_ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+  m_ofs.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+}
+
+std::vector<std::uint8_t> FrameStream::deflate_rect(const png::image<png::rgb_pixel>& img, const Rect& r,
+                                                    const png::image<png::rgb_pixel>* previous) const {
+  int n = 4 * (r.x1 - r.x0);
+  int rows = r.y1 - r.y0;
+  int filter = m_opt.png_filter;
+
+  // RGBA pixels; against a previous frame, the unchanged pixels are fully
+  // transparent (zeros, which deflate to almost nothing)
+  std::vector<std::uint8_t> rgba(1L * rows * n);
+  tbb::parallel_for(tbb::blocked_range<int>(0, rows), [&](const tbb::blocked_range<int>& range) {
+    for (int i = range.begin(); i < range.end(); i++) {
+      const png::rgb_pixel* cur = img.get_row(r.y0 + i).data() + r.x0;
+      const png::rgb_pixel* old = previous ? previous->get_row(r.y0 + i).data() + r.x0 : nullptr;
+      std::uint8_t* out = rgba.data() + 1L * i * n;
+      for (int j = 0; j < r.x1 - r.x0; j++) {
+        const png::rgb_pixel& p = cur[j];
+        if (old && p.red == old[j].red && p.green == old[j].green && p.blue == old[j].blue) {
+          std::fill(out + 4 * j, out + 4 * j + 4, 0);
+        } else {
+          out[4 * j] = p.red;
+          out[4 * j + 1] = p.green;
+          out[4 * j + 2] = p.blue;
+          out[4 * j + 3] = 255;
+        }
+      }
+    }
+  });
+
+  std::vector<std::uint8_t> zero(n, 0);
+  std::vector<std::uint8_t> filtered(1L * rows * (n + 1));
+  // each row only reads its own pixels and the row above: filtered in parallel
+  tbb::parallel_for(tbb::blocked_range<int>(0, rows), [&](const tbb::blocked_range<int>& range) {
+    std::vector<std::uint8_t> trial(n);
+    for (int i = range.begin(); i < range.end(); i++) {
+      const std::uint8_t* cur = rgba.data() + 1L * i * n;
+      const std::uint8_t* prev = i > 0 ? cur - n : zero.data();
+      std::uint8_t* out = filtered.data() + 1L * i * (n + 1);
+      if (filter >= 0 && filter <= 4) {
+        out[0] = filter;
+        filter_row(filter, cur, prev, n, out + 1);
+        continue;
+      }
+      // adaptive: the filter with the smallest cost for this row
+      long best = -1;
+      for (int type = 0; type <= 4; type++) {
+        filter_row(type, cur, prev, n, trial.data());
+        long cost = filter_cost(trial.data(), n);
+        if (best < 0 || cost < best) {
+          best = cost;
+          out[0] = type;
+          std::copy(trial.begin(), trial.end(), out + 1);
+        }
+      }
+    }
+  });
+
+  uLongf size = compressBound(filtered.size());
+  std::vector<std::uint8_t> compressed(size);
+  int level = m_opt.png_level >= 0 ? m_opt.png_level : Z_DEFAULT_COMPRESSION;
+  if (compress2(compressed.data(), &size, filtered.data(), filtered.size(), level) != Z_OK) {
+    throw std::runtime_error("zlib compression failed");
+  }
+  compressed.resize(size);
+  return compressed;
+}
+
+void FrameStream::write(const png::image<png::rgb_pixel>& img) {
+  int w = img.get_width();
+  int h = img.get_height();
+  if (m_opt.format == ImageFormat::Y4M) {
+    write_y4m(m_ofs, img, m_opt.fps, m_written == 0);
+    m_written++;
+    return;
+  }
+
+  // delay of each frame: 1 / fps seconds
+  const int blend_source = 0;
+  const int blend_over = 1;
+  auto frame_control = [&](const Rect& r, int blend) {
+    std::vector<std::uint8_t> fctl;
+    put32(fctl, m_sequence++);
+    put32(fctl, r.x1 - r.x0);
+    put32(fctl, r.y1 - r.y0);
+    put32(fctl, r.x0);
+    put32(fctl, r.y0);
+    put16(fctl, 1);
+    put16(fctl, m_opt.fps);
+    fctl.push_back(0);  // dispose_op NONE
+    fctl.push_back(blend);
+    write_chunk("fcTL", fctl);
+  };
+
+  if (m_written == 0) {
+    static const char signature[8] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+    m_ofs.write(signature, 8);
+    std::vector<std::uint8_t> ihdr;
+    put32(ihdr, w);
+    put32(ihdr, h);
+    ihdr.insert(ihdr.end(), {8, 6, 0, 0, 0});  // 8 bits, RGBA, deflate, filters, no interlace
+    write_chunk("IHDR", ihdr);
+    std::vector<std::uint8_t> actl;
+    put32(actl, m_frames);
+    put32(actl, 0);  // loop forever
+    write_chunk("acTL", actl);
+
+    Rect all{0, 0, w, h};
+    frame_control(all, blend_source);
+    write_chunk("IDAT", deflate_rect(img, all, nullptr));
+  } else {
+    Rect r = changed_rect(m_previous, img);
+    if (r.empty()) {
+      // the frame still takes its time on screen
+      r = Rect{0, 0, 1, 1};
+    }
+    frame_control(r, blend_over);
+    std::vector<std::uint8_t> fdat;
+    put32(fdat, m_sequence++);
+    std::vector<std::uint8_t> data = deflate_rect(img, r, &m_previous);
+    fdat.insert(fdat.end(), data.begin(), data.end());
+    write_chunk("fdAT", fdat);
+  }
+  m_previous = img;
+  m_written++;
+}
+
+void FrameStream::finish() {
+  if (m_opt.format == ImageFormat::APNG && m_written > 0) {
+    write_chunk("IEND", {});
+  }
+  m_ofs.flush();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <png++/png.hpp>
+#include <string>
+#include <vector>
+
+/*
+ * Image encoders for save_solution, chosen by the extension of the output
+ * template:
+ *
+ *   .ppm  binary PPM (P6): header and raw pixels, one write, no compression
+ *   .qoi  QOI (https://qoiformat.org): a single pass over the pixels with
+ *         run-length, index and delta codes, lossless
+ *   .y4m  YUV4MPEG2 video stream: all the frames go to a single file, a
+ *         named pipe, or the standard output for the path "-"
+ *   .apng animated PNG: all the frames in a single file, each frame after
+ *         the first reduced to the rectangle of pixels that changed
+ *   else  PNG through libpng, with a configurable zlib level and row filter
+ *
+ * PPM is the fastest and largest, QOI is typically within a factor of two
+ * of the PNG size for a fraction of the encode time.
+ *
+ * Y4M frames are raw 4:2:0 YUV (BT.601, limited range, chroma averaged over
+ * 2x2 pixels), which video encoders read directly: a stream piped into an
+ * encoder replaces the per-frame files and the PNG encode/decode round
+ * trip.
+ */
+enum class ImageFormat { PNG, PPM, QOI, Y4M, APNG };
+
+struct ImageOptions {
+  ImageFormat format = ImageFormat::PNG;
+  int png_level = -1;   // zlib level 0 to 9, -1 for the zlib default
+  int png_filter = -1;  // 0 none, 1 sub, 2 up, 3 average, 4 Paeth, 5 all (adaptive), -1 for the libpng default
+  int fps = 25;         // frame rate of the Y4M and APNG streams
+};
+
+// Format of an output path, from its extension (PNG if unknown, Y4M for "-")
+ImageFormat image_format(const std::string& path);
+
+// Single output stream for all the frames of a run (Y4M, APNG)
+inline bool is_stream(ImageFormat format) {
+  return format == ImageFormat::Y4M || format == ImageFormat::APNG;
+}
+
+// File to open for a stream whose first frame is iteration `first`:
+// /dev/stdout for "-", the path itself for a named pipe or for 0, otherwise
+// "-" and the iteration before the extension (film.y4m -> film-000041.y4m),
+// so a restart does not overwrite the frames of the interrupted run
+std::string stream_path(const std::string& path, int first);
+
+void write_image(std::ostream& ofs, const png::image<png::rgb_pixel>& img, const ImageOptions& opt);
+
+void write_ppm(std::ostream& ofs, const png::image<png::rgb_pixel>& img);
+void write_qoi(std::ostream& ofs, const png::image<png::rgb_pixel>& img);
+void write_png(std::ostream& ofs, const png::image<png::rgb_pixel>& img, int level, int filter);
+
+// One Y4M frame, preceded by the stream header if `header`
+void write_y4m(std::ostream& ofs, const png::image<png::rgb_pixel>& img, int fps, bool header);
+
+// Convert to 4:2:0 planes: y is width x height, u and v are
+// ceil(width / 2) x ceil(height / 2). Rows are converted in parallel.
+void rgb_to_yuv420(const png::image<png::rgb_pixel>& img, std::uint8_t* y, std::uint8_t* u, std::uint8_t* v);
+
+// Pixels [x0, x1) x [y0, y1)
+struct Rect {
+  int x0 = 0;
+  int y0 = 0;
+  int x1 = 0;
+  int y1 = 0;
+
+  bool empty() const {
+    return x1 <= x0 || y1 <= y0;
+  }
+
+  // Smallest rectangle containing both
+  Rect unite(const Rect& o) const;
+};
+
+// Bounding rectangle of the pixels that differ between two images of the
+// same size, empty if they are equal; rows are compared in parallel
+Rect changed_rect(const png::image<png::rgb_pixel>& a, const png::image<png::rgb_pixel>& b);
+
+/*
+ * All the frames of a run written to one stream.
+ *
+ * Y4M: the header, then one raw frame per image.
+ *
+ * APNG (RGBA): the first frame is the default image (IDAT), readable by
+ * any PNG decoder. Each following frame only stores the bounding rectangle
+ * of the pixels that changed since the previous frame, with dispose_op NONE
+ * (the canvas keeps the previous frame) and blend_op OVER: inside the
+ * rectangle, unchanged pixels are fully transparent and leave the canvas
+ * as it is, and they deflate to almost nothing. This matters because with
+ * many charges the changes are sparse but spread over the whole image. An
+ * unchanged frame is a single transparent pixel. The frame count goes in
+ * the header, before the frames, so the stream works on pipes too: it must
+ * be known at construction.
+ */
+class FrameStream {
+public:
+  FrameStream(std::ostream& ofs, const ImageOptions& opt, int frames);
+
+  void write(const png::image<png::rgb_pixel>& img);
+
+  // Write the APNG trailer; nothing for Y4M
+  void finish();
+
+  int m_written = 0;
+
+private:
+  void write_chunk(const char* type, const std::vector<std::uint8_t>& data);
+
+  // Filtered and deflated RGBA pixels of rectangle r, transparent where
+  // they equal the previous frame if given
+  std::vector<std::uint8_t> deflate_rect(const png::image<png::rgb_pixel>& img, const Rect& r,
+                                         const png::image<png::rgb_pixel>* previous) const;
+
+  std::ostream& m_ofs;
+  ImageOptions m_opt;
+  int m_frames;
+  std::uint32_t m_sequence = 0;  // APNG sequence number of the next fcTL or fdAT
+  png::image<png::rgb_pixel> m_previous;
+};
@@ -1,17 +1,25 @@
 #include <uqam/tp.h>
 
+#include <tbb/global_control.h>
+
 #include <Eigen/Dense>
+#include <chrono>
 #include <filesystem>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <vector>
 
+#include "autotune.h"
 #include "colormap.h"
+#include "engine.h"
+#include "ensemble.h"
 #include "experiments.h"
 #include "optparser.hpp"
 #include "particle.h"
+#include "particleio.h"
 #include "potential.h"
-#include "potentialparallel.h"
+#include "replicas.h"
 
 using namespace Eigen;
 
@@ -29,9 +37,26 @@ int main(int argc, char** argv) {
   int experiment = 0;
   std::string outfmt("results/potential-{:06d}.png");
   bool update_scale = false;
-  int parallel = 0;
   int numpart = 10;
   int substeps = 10;
+  int threads = 0;
+  bool diagnostics = false;
+  EngineConfig engine;
+  std::string tune_file("potential-tuning.txt");
+  std::string rawfmt;
+  FieldStoreOptions raw;
+  int reorder = 0;
+  int seed = 0;
+  std::string input;
+  std::string particles_output;
+  std::string checkpoint;
+  int checkpoint_every = 0;
+  bool restart = false;
+  std::string ensemble;
+  int replicas = 0;
+  bool parareal = false;
+  PararealOptions parareal_opt;
+  ImageOptions image;
 
   OptionsParser args(argc, argv);
   args.AddOption(&colormap_name, "-c", "--color-map", "color map file");
@@ -39,41 +64,204 @@ int main(int argc, char** argv) {
   args.AddOption(&dt, "-dt", "--timestep", "timestep");
   args.AddOption(&verbose, "-v", "--verbose", "-q", "--quiet", "timestep");
   args.AddOption(&resol, "-r", "--resolution", "image resolution");
-  args.AddOption(&experiment, "-e", "--experiment", "experiment id");
-  args.AddOption(&outfmt, "-o", "--output", "output file template");
+  args.AddOption(&experiment, "-e", "--experiment",
+                 "experiment id (0: random, 1: crystal, 2: collision, 3: basic, 4: random, counter-based)");
+  args.AddOption(&seed, "-sd", "--seed", "seed of the random experiments (-e 0 and 4)");
+  args.AddOption(&input, "-in", "--input", "particle file, binary or .csv (replaces the experiment)");
+  args.AddOption(&particles_output, "-po", "--particles-output", "write the final particles to this binary file");
+  args.AddOption(&checkpoint, "-ck", "--checkpoint", "checkpoint file");
+  args.AddOption(&checkpoint_every, "-ce", "--checkpoint-every", "write a checkpoint every K iterations (0: never)");
+  args.AddOption(&restart, "-rs", "--restart", "-nrs", "--no-restart", "resume from the checkpoint file if it exists");
+  args.AddOption(&ensemble, "-en", "--ensemble", "file of simulations to run together, one per line (see ensemble.h)");
+  args.AddOption(&parareal, "-pr", "--parareal", "-npr", "--no-parareal",
+                 "integrate all the iterations in parallel in time (parareal, serial propagators)");
+  args.AddOption(&parareal_opt.coarse_substeps, "-prc", "--parareal-coarse", "substeps of the coarse propagator");
+  args.AddOption(&parareal_opt.tol, "-prt", "--parareal-tol", "parareal tolerance on the positions");
+  args.AddOption(&replicas, "-rp", "--replicas",
+                 "advance this many replicas of the experiment (seeds seed, seed + 1, ...) in SIMD lanes, without images");
+  args.AddOption(&outfmt, "-o", "--output",
+                 "output file template (.png, .ppm or .qoi), or single stream of all the frames (.apng, .y4m file or "
+                 "named pipe, - for stdout)");
+  args.AddOption(&image.fps, "-fps", "--fps", "frame rate of the y4m and apng streams");
+  args.AddOption(&image.png_level, "-pl", "--png-level", "zlib level of the PNG images (0 to 9, -1: default)");
+  args.AddOption(&image.png_filter, "-pf", "--png-filter",
+                 "row filter of the PNG images (0: none, 1: sub, 2: up, 3: average, 4: Paeth, 5: adaptive, -1: default)");
   args.AddOption(&update_scale, "-us", "--update-scale", "-nus", "--no-update-scale",
                  "update color scale at each timestep");
-  args.AddOption(&parallel, "-p", "--parallel", "parallel engine (0: serial, 1: tbb)");
+  args.AddOption(&engine.engine, "-p", "--parallel",
+                 "parallel engine (-1: auto-tune, 0: serial, 1: tbb, 2: tbb tiled, 3: tbb row sweep, 4: tbb fast math, "
+                 "5: fft)");
   args.AddOption(&numpart, "-n", "--num-particles", "number of particles to create");
   args.AddOption(&substeps, "-s", "--substeps", "number of substeps per timestep");
+  args.AddOption(&engine.tile_rows, "-tr", "--tile-rows", "pixel rows per tile (tiled engine)");
+  args.AddOption(&engine.tile_cols, "-tc", "--tile-cols", "pixel columns per tile (tiled engine)");
+  args.AddOption(&engine.tile_charges, "-tk", "--tile-charges", "charges per block (tiled and row sweep engines)");
+  args.AddOption(&engine.newton, "-fa", "--fast-accuracy", "newton steps of the fast math engine (1 to 3)");
+  args.AddOption(&engine.fft_cic, "-cic", "--fft-cic", "-ngp", "--fft-nearest",
+                 "cloud-in-cell or nearest pixel charge deposit (fft engine)");
+  args.AddOption(&threads, "-t", "--threads", "maximum number of threads (0: all)");
+  args.AddOption(&engine.numa, "-numa", "--numa", "-nonuma", "--no-numa", "one task arena per NUMA node (tbb engine, -p 1)");
+  args.AddOption(&tune_file, "-tf", "--tune-file", "auto-tuning cache file");
+  args.AddOption(&diagnostics, "-diag", "--diagnostics", "-nodiag", "--no-diagnostics",
+                 "print energy and momentum at each iteration");
+  args.AddOption(&engine.dispatch, "-d", "--dispatch", "-nd", "--no-dispatch",
+                 "choose serial or parallel execution per phase from a cost model (tbb engines)");
+  args.AddOption(&engine.efield, "-ef", "--efield", "-noef", "--no-efield",
+                 "compute the electric field with the potential (tbb engine)");
+  args.AddOption(&rawfmt, "-ro", "--raw-output",
+                 "raw field file template (none if empty), or compressed store of all the frames (.fldz)");
+  args.AddOption(&raw.keyframe, "-rk", "--raw-keyframe", "frames between key frames of the .fldz store");
+  args.AddOption(&raw.mantissa_bits, "-rb", "--raw-bits", "mantissa bits kept in the .fldz store (52: lossless)");
+  args.AddOption(&engine.cutoff, "-rc", "--cutoff", "range of the forces, 0 for no cutoff (tbb engines, without -pr or -rp)");
+  args.AddOption(&engine.skin, "-sk", "--skin", "Verlet neighbour list margin beyond the cutoff");
+  args.AddOption(&engine.periodic, "-pb", "--periodic", "-npb", "--no-periodic",
+                 "periodic unit square, forces and potential by particle-mesh Ewald (tbb engine)");
+  args.AddOption(&engine.ewald_accuracy, "-ea", "--ewald-accuracy", "target relative accuracy of the Ewald sums");
+  args.AddOption(&reorder, "-mo", "--morton", "sort the particles in Morton order every K iterations (0: never)");
 
   args.Parse();
   if (!args.Good()) {
     args.PrintUsage(std::cout);
     return 1;
   }
+  // La vidéo sur la sortie standard: les messages passent sur la sortie
+  // d'erreur
+  if (outfmt == "-") {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
   args.PrintOptions(std::cout);
+  if (image.png_level < -1 || image.png_level > 9 || image.png_filter < -1 || image.png_filter > 5) {
+    std::cerr << "--png-level must be in [-1, 9] and --png-filter in [-1, 5]" << std::endl;
+    return 1;
+  }
+  if (raw.keyframe < 1 || raw.mantissa_bits < 0 || raw.mantissa_bits > 52) {
+    std::cerr << "--raw-keyframe must be at least 1 and --raw-bits in [0, 52]" << std::endl;
+    return 1;
+  }
+  if (engine.engine < ENGINE_AUTO || engine.engine > ENGINE_FFT) {
+    std::cerr << "--parallel must be in [-1, 5]" << std::endl;
+    return 1;
+  }
+  if (engine.numa && engine.engine != ENGINE_TBB && engine.engine != ENGINE_AUTO) {
+    std::cerr << "--numa requires the tbb engine (-p 1)" << std::endl;
+    return 1;
+  }
+  if (engine.periodic && engine.engine != ENGINE_TBB) {
+    std::cerr << "--periodic requires the tbb engine (-p 1)" << std::endl;
+    return 1;
+  }
+  if (engine.efield && (engine.engine != ENGINE_TBB || engine.periodic)) {
+    std::cerr << "--efield requires the tbb engine (-p 1) without --periodic" << std::endl;
+    return 1;
+  }
+  // parareal et les répliques intègrent avec des propagateurs sans bords
+  // périodiques
+  if (engine.periodic && (parareal || replicas > 0)) {
+    std::cerr << "--periodic cannot be combined with --parareal or --replicas" << std::endl;
+    return 1;
+  }
+  // seules les expériences aléatoires dépendent de la graine: les autres
+  // donneraient des répliques identiques
+  if (replicas > 0 && experiment != 0 && experiment != 4) {
+    std::cerr << "--replicas requires a random experiment (-e 0 or 4)" << std::endl;
+    return 1;
+  }
+  // le moteur série, parareal et les répliques calculent toutes les paires
+  if (engine.cutoff > 0 && (engine.engine == ENGINE_SERIAL || parareal || replicas > 0)) {
+    std::cerr << "--cutoff requires a tbb engine, without --parareal or --replicas" << std::endl;
+    return 1;
+  }
 
-  std::filesystem::path path(outfmt);
-  std::filesystem::path basedir = path.parent_path();
-  if (!basedir.empty() && !std::filesystem::exists(basedir)) {
-    std::filesystem::create_directories(basedir);
+  std::unique_ptr<tbb::global_control> limit;
+  if (threads > 0) {
+    limit = std::make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism, threads);
+  }
+
+  for (const std::string& fmt : {outfmt, rawfmt}) {
+    std::filesystem::path path(fmt);
+    std::filesystem::path basedir = path.parent_path();
+    if (!basedir.empty() && !std::filesystem::exists(basedir)) {
+      std::filesystem::create_directories(basedir);
+    }
   }
 
   // Charger la carte de couleurs
   ColorMap cmap;
   cmap.load(colormap_name);
 
+  // Exécuter un ensemble de simulations, les options servent de valeurs
+  // par défaut
+  if (!ensemble.empty()) {
+    Job base;
+    base.engine = engine;
+    base.engine.width = resol;
+    base.engine.height = resol;
+    base.experiment = experiment;
+    base.numpart = numpart;
+    base.seed = seed;
+    base.max_iter = max_iter;
+    base.dt = dt;
+    base.substeps = substeps;
+    base.update_scale = update_scale;
+    std::ifstream ifs(ensemble);
+    if (!ifs) {
+      std::cerr << "cannot open " << ensemble << std::endl;
+      return 1;
+    }
+    std::vector<Job> jobs;
+    try {
+      jobs = parse_jobs(ifs, base);
+    } catch (const std::runtime_error& e) {
+      std::cerr << ensemble << ": " << e.what() << std::endl;
+      return 1;
+    }
+    run_ensemble(jobs, cmap, true);
+    std::cout << "Fin normale du programme" << std::endl;
+    return 0;
+  }
+
+  // Répliques d'un petit système, une par voie SIMD; seules les particules
+  // finales sont écrites (-po), toutes les répliques à la suite
+  if (replicas > 0) {
+    std::vector<Particle> particles;
+    make_experiment(experiment, numpart, seed, particles);
+    ReplicaBatch batch(particles.size(), replicas);
+    for (int r = 0; r < replicas; r++) {
+      particles.clear();
+      make_experiment(experiment, numpart, seed + r, particles);
+      batch.load(r, particles);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int iter = 0; iter < max_iter; iter++) {
+      batch.move_particles(dt, substeps);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "replicas: " << replicas << " x " << particles.size() << " particles, " << elapsed.count() << " s, "
+              << 1.0 * replicas * max_iter * substeps / elapsed.count() << " replica substeps/s" << std::endl;
+    if (!particles_output.empty()) {
+      std::ofstream ofs(particles_output, std::ios::binary);
+      ParticleWriter writer(ofs);
+      for (int r = 0; r < replicas; r++) {
+        batch.store(r, particles);
+        writer.write(particles);
+      }
+      writer.finish();
+    }
+    std::cout << "Fin normale du programme" << std::endl;
+    return 0;
+  }
+
   // Générer des charges
   std::vector<Particle> particles;
-  if (experiment == 0) {
-    experiment_random(numpart, particles);
-  } else if (experiment == 1) {
-    experiment_crystal(numpart, particles);
-  } else if (experiment == 2) {
-    experiment_collision(numpart, particles);
-  } else if (experiment == 3) {
-    experiment_basic(particles);
+  if (!input.empty()) {
+    try {
+      load_particles(input, particles);
+    } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  } else {
+    make_experiment(experiment, numpart, seed, particles);
   }
 
   // Afficher les particules
@@ -88,15 +276,32 @@ int main(int argc, char** argv) {
   }
 
   // Calculer le potentiel électrique sur la grille
-  IPotential* simulator;
-  if (parallel == 0) {
-    simulator = new PotentialSerial(resol, resol);
-  } else {
-    simulator = new PotentialParallel(resol, resol);
+  engine.width = resol;
+  engine.height = resol;
+  if (engine.engine == ENGINE_AUTO) {
+    engine = autotune(engine, particles, dt, substeps, tune_file, verbose);
   }
+  IPotential* simulator = make_engine(engine);
+  simulator->m_diagnostics = diagnostics;
+  simulator->m_rawfmt = rawfmt;
+  simulator->m_raw = raw;
+  simulator->m_image = image;
+  simulator->m_reorder = reorder;
+  simulator->m_checkpoint = checkpoint;
+  simulator->m_checkpoint_every = checkpoint_every;
+  simulator->m_restart = restart;
+  simulator->m_parareal = parareal;
+  simulator->m_parareal_opt = parareal_opt;
 
   simulator->run(particles, max_iter, dt, substeps, update_scale, cmap, outfmt, verbose);
 
+  if (!particles_output.empty()) {
+    std::ofstream ofs(particles_output, std::ios::binary);
+    ParticleWriter writer(ofs);
+    writer.write(particles);
+    writer.finish();
+  }
+
   delete simulator;
   std::cout << "Fin normale du programme" << std::endl;
   return 0;
@@ -0,0 +1,105 @@
+#include "morton.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_sort.h>
+
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+// Spread the 32 bits of v over the even bits of the result
+std::uint64_t spread_bits(std::uint32_t v) {
+  std::uint64_t x = v;
+  x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  x = (x | (x << 2)) & 0x3333333333333333ULL;
+  x = (x | (x << 1)) & 0x5555555555555555ULL;
+  return x;
+}
+
+struct Box {
+  Vector2d lo = Vector2d::Constant(std::numeric_limits<double>::max());
+  Vector2d hi = Vector2d::Constant(std::numeric_limits<double>::lowest());
+
+  Box combine(const Box& o) const {
+    return Box{lo.cwiseMin(o.lo), hi.cwiseMax(o.hi)};
+  }
+};
+
+// Move the particle at order[i] to i, in parallel
+void permute(std::vector<Particle>& particles, std::vector<int>& ids, const std::vector<int>& order) {
+  int n = particles.size();
+  std::vector<Particle> sorted(particles);
+  std::vector<int> sorted_ids(n);
+  tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); ++i) {
+      sorted[i] = particles[order[i]];
+      sorted_ids[i] = ids[order[i]];
+    }
+  });
+  particles.swap(sorted);
+  ids.swap(sorted_ids);
+}
+
+}  // namespace
+
+std::uint64_t morton_code(std::uint32_t x, std::uint32_t y) {
+  return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+void morton_sort(std::vector<Particle>& particles, std::vector<int>& ids) {
+  int n = particles.size();
+  if (ids.empty()) {
+    ids.resize(n);
+    std::iota(ids.begin(), ids.end(), 0);
+  }
+
+  Box box = tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, n), Box(),
+      [&](const tbb::blocked_range<int>& r, Box b) {
+        for (int i = r.begin(); i < r.end(); ++i) {
+          b.lo = b.lo.cwiseMin(particles[i].m_x);
+          b.hi = b.hi.cwiseMax(particles[i].m_x);
+        }
+        return b;
+      },
+      [](const Box& a, const Box& b) { return a.combine(b); });
+
+  // quantize to 32 bits per axis; the index breaks ties, so the order
+  // does not depend on the sort
+  const double cells = 4294967295.0;
+  Vector2d extent = box.hi - box.lo;
+  Vector2d scale(extent(0) > 0 ? cells / extent(0) : 0.0, extent(1) > 0 ? cells / extent(1) : 0.0);
+  std::vector<std::pair<std::uint64_t, int>> keys(n);
+  tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); ++i) {
+      Vector2d q = (particles[i].m_x - box.lo).cwiseProduct(scale);
+      keys[i] = {morton_code(std::uint32_t(q(0)), std::uint32_t(q(1))), i};
+    }
+  });
+  tbb::parallel_sort(keys.begin(), keys.end());
+
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = keys[i].second;
+  }
+  permute(particles, ids, order);
+}
+
+void restore_order(std::vector<Particle>& particles, std::vector<int>& ids) {
+  int n = particles.size();
+  if (ids.empty()) {
+    return;
+  }
+  // order[id] = current slot of the particle of original index id
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i) {
+    order[ids[i]] = i;
+  }
+  permute(particles, ids, order);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "particle.h"
+
+/*
+ * Morton (Z-order) reordering of the particles.
+ *
+ * Positions are quantized to 32 bits per axis over the bounding box of the
+ * particles and their bits interleaved, so particles close in space are
+ * mostly close in memory. `ids` is the persistent permutation: ids[i] is
+ * the original index of the particle stored at i. It is permuted with the
+ * particles, and restore_order puts them back in original order.
+ */
+
+// Interleave the bits of x (even bits) and y (odd bits)
+std::uint64_t morton_code(std::uint32_t x, std::uint32_t y);
+
+// Sort particles by Morton code in parallel, permuting ids the same way.
+// An empty ids is first set to the identity.
+void morton_sort(std::vector<Particle>& particles, std::vector<int>& ids);
+
+// Put the particles back in original order and reset ids to the identity
+void restore_order(std::vector<Particle>& particles, std::vector<int>& ids);
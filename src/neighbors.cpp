@@ -0,0 +1,115 @@
+#include "neighbors.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+bool NeighborList::stale(const std::vector<Vector2d>& x, double cutoff, double skin, int grain) const {
+  int n = x.size();
+  if (size() != n || cutoff != m_cutoff || skin != m_skin) {
+    return true;
+  }
+  double max_d2 = tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, n, grain), 0.0,
+      [&](const tbb::blocked_range<int>& r, double d2) {
+        for (int i = r.begin(); i < r.end(); ++i) {
+          d2 = std::max(d2, (x[i] - m_ref[i]).squaredNorm());
+        }
+        return d2;
+      },
+      [](double a, double b) { return std::max(a, b); });
+  return max_d2 > 0.25 * skin * skin;
+}
+
+void NeighborList::build(const std::vector<Vector2d>& x, double cutoff, double skin, int grain) {
+  int n = x.size();
+  double radius = cutoff + skin;
+  double radius2 = radius * radius;
+  m_ref = x;
+  m_cutoff = cutoff;
+  m_skin = skin;
+  m_builds++;
+
+  // cell grid over the bounding box, cells at least `radius` wide, so the
+  // neighbours of a particle are in its cell or the 8 around it
+  Vector2d lo = Vector2d::Constant(std::numeric_limits<double>::max());
+  Vector2d hi = Vector2d::Constant(std::numeric_limits<double>::lowest());
+  for (const Vector2d& p : x) {
+    lo = lo.cwiseMin(p);
+    hi = hi.cwiseMax(p);
+  }
+  const int max_cells = 1024;
+  int nx = 1;
+  int ny = 1;
+  if (n > 0) {
+    nx = int(std::clamp((hi(0) - lo(0)) / radius, 1.0, double(max_cells)));
+    ny = int(std::clamp((hi(1) - lo(1)) / radius, 1.0, double(max_cells)));
+  }
+  double cw = (hi(0) - lo(0)) / nx;
+  double ch = (hi(1) - lo(1)) / ny;
+  auto cell_of = [&](const Vector2d& p, int& cx, int& cy) {
+    cx = cw > 0 ? std::min(int((p(0) - lo(0)) / cw), nx - 1) : 0;
+    cy = ch > 0 ? std::min(int((p(1) - lo(1)) / ch), ny - 1) : 0;
+  };
+
+  // counting sort of the particles by cell
+  std::vector<int> cell_start(nx * ny + 1, 0);
+  std::vector<int> cell(n);
+  for (int i = 0; i < n; ++i) {
+    int cx, cy;
+    cell_of(x[i], cx, cy);
+    cell[i] = cy * nx + cx;
+    cell_start[cell[i] + 1]++;
+  }
+  for (int c = 0; c < nx * ny; ++c) {
+    cell_start[c + 1] += cell_start[c];
+  }
+  std::vector<int> members(n);
+  std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+  for (int i = 0; i < n; ++i) {
+    members[fill[cell[i]]++] = i;
+  }
+
+  // visit(i, f) calls f(j) for every j != i within radius
+  auto visit = [&](int i, auto&& f) {
+    int cx = cell[i] % nx;
+    int cy = cell[i] / nx;
+    for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, ny - 1); ++y) {
+      for (int xc = std::max(cx - 1, 0); xc <= std::min(cx + 1, nx - 1); ++xc) {
+        int c = y * nx + xc;
+        for (int k = cell_start[c]; k < cell_start[c + 1]; ++k) {
+          int j = members[k];
+          if (j != i && (x[i] - x[j]).squaredNorm() < radius2) {
+            f(j);
+          }
+        }
+      }
+    }
+  };
+
+  // two passes: count, then fill the rows at their prefix sum offsets
+  m_start.assign(n + 1, 0);
+  tbb::parallel_for(tbb::blocked_range<int>(0, n, grain), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); ++i) {
+      int count = 0;
+      visit(i, [&](int) { count++; });
+      m_start[i + 1] = count;
+    }
+  });
+  for (int i = 0; i < n; ++i) {
+    m_start[i + 1] += m_start[i];
+  }
+  m_index.resize(m_start[n]);
+  tbb::parallel_for(tbb::blocked_range<int>(0, n, grain), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); ++i) {
+      int* row = m_index.data() + m_start[i];
+      int k = 0;
+      visit(i, [&](int j) { row[k++] = j; });
+      std::sort(row, row + k);
+    }
+  });
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+
+using Eigen::Vector2d;
+
+/*
+ * Verlet neighbour list for a short-range force of range `cutoff`.
+ *
+ * The list holds every pair closer than cutoff + skin at the time it is
+ * built. As long as no particle has moved more than skin / 2 since then,
+ * no pair can have come closer than the cutoff without being in the list,
+ * so the list stays valid over many substeps.
+ *
+ * The neighbours of particle i are m_index[m_start[i]] to
+ * m_index[m_start[i + 1] - 1] (CSR layout), sorted by index, so a sum over
+ * the list visits the pairs in the same order as a loop over all j.
+ */
+class NeighborList {
+public:
+  // True if the list must be rebuilt for positions x
+  bool stale(const std::vector<Vector2d>& x, double cutoff, double skin, int grain) const;
+
+  // Rebuild from positions x with a cell grid of cell size cutoff + skin
+  void build(const std::vector<Vector2d>& x, double cutoff, double skin, int grain);
+
+  int size() const {
+    return m_start.empty() ? 0 : int(m_start.size()) - 1;
+  }
+
+  std::vector<int> m_start;  // first neighbour of each particle, size n + 1
+  std::vector<int> m_index;  // neighbour indices
+  int m_builds = 0;          // number of rebuilds, for the statistics
+
+private:
+  std::vector<Vector2d> m_ref;  // positions at the last build
+  double m_cutoff = 0.0;
+  double m_skin = 0.0;
+};
@@ -0,0 +1,10 @@
+#include "numa.h"
+
+#include <tbb/info.h>
+
+NumaArenas::NumaArenas() {
+  for (tbb::numa_node_id id : tbb::info::numa_nodes()) {
+    m_arenas.push_back(std::make_unique<tbb::task_arena>(tbb::task_arena::constraints(id)));
+    m_groups.push_back(std::make_unique<tbb::task_group>());
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+
+#include <memory>
+#include <vector>
+
+/*
+ * Allocator that leaves the elements default-initialized, i.e. untouched
+ * for doubles. A page of memory is placed on the NUMA node of the thread
+ * that writes it first; with std::allocator the zero-fill done by the
+ * constructor would place the whole buffer on the main thread's node.
+ */
+template <typename T>
+struct default_init_allocator : std::allocator<T> {
+  template <typename U>
+  struct rebind {
+    using other = default_init_allocator<U>;
+  };
+
+  default_init_allocator() = default;
+
+  template <typename U>
+  default_init_allocator(const default_init_allocator<U>&) noexcept {
+  }
+
+  template <typename U>
+  void construct(U* ptr) noexcept {
+    ::new (static_cast<void*>(ptr)) U;
+  }
+
+  template <typename U, typename... Args>
+  void construct(U* ptr, Args&&... args) {
+    ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+  }
+};
+
+/*
+ * One task_arena per NUMA node, with image rows statically split in
+ * contiguous bands, one band per node. Work submitted for a band only runs
+ * on threads pinned to that node, so the band is first touched and later
+ * read by the same socket.
+ *
+ * Without hwloc support in TBB, a single node is reported and everything
+ * runs in one arena.
+ */
+class NumaArenas {
+public:
+  NumaArenas();
+
+  int size() const {
+    return m_arenas.size();
+  }
+
+  // Band of rows assigned to a node
+  tbb::blocked_range<int> rows(int node, int height) const {
+    return tbb::blocked_range<int>(int(1L * node * height / size()), int(1L * (node + 1) * height / size()));
+  }
+
+  // Call f(node) inside the arena of every node concurrently and wait for
+  // all of them.
+  template <typename F>
+  void run(F&& f) {
+    for (int node = 0; node < size(); node++) {
+      m_arenas[node]->execute([&, node] { m_groups[node]->run([&, node] { f(node); }); });
+    }
+    for (int node = 0; node < size(); node++) {
+      m_arenas[node]->execute([&, node] { m_groups[node]->wait(); });
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<tbb::task_arena>> m_arenas;
+  std::vector<std::unique_ptr<tbb::task_group>> m_groups;
+};
@@ -0,0 +1,60 @@
+#include "parareal.h"
+
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+
+#include "potential.h"
+
+namespace {
+
+// State after one slice of dt, with the serial engine (no shared state, so
+// slices can be propagated concurrently)
+std::vector<Particle> propagate(const std::vector<Particle>& from, double dt, int substeps) {
+  std::vector<Particle> p(from);
+  PotentialSerial engine(1, 1);
+  engine.move_particles(p, dt, substeps);
+  return p;
+}
+
+}  // namespace
+
+int parareal(std::vector<std::vector<Particle>>& states, int slices, double dt, const PararealOptions& opt) {
+  states.resize(slices + 1);
+
+  // coarse[n] = G(states[n]), kept for the correction of the next iteration
+  std::vector<std::vector<Particle>> coarse(slices);
+  std::vector<std::vector<Particle>> fine(slices);
+  for (int n = 0; n < slices; n++) {
+    coarse[n] = propagate(states[n], dt, opt.coarse_substeps);
+    states[n + 1] = coarse[n];
+  }
+
+  int max_iterations = opt.max_iterations > 0 ? std::min(opt.max_iterations, slices) : slices;
+  int k = 0;
+  while (k < max_iterations) {
+    // states[k] is exact, the fine propagation starts there
+    tbb::parallel_for(k, slices, [&](int n) { fine[n] = propagate(states[n], dt, opt.fine_substeps); });
+    k++;
+
+    double change = 0.0;
+    for (int n = k - 1; n < slices; n++) {
+      std::vector<Particle> g = propagate(states[n], dt, opt.coarse_substeps);
+      std::vector<Particle>& next = states[n + 1];
+      for (size_t i = 0; i < next.size(); i++) {
+        // where states[n] did not change, g == coarse[n] and the result is
+        // exactly the fine state
+        Particle c = fine[n][i];
+        c.m_x += g[i].m_x - coarse[n][i].m_x;
+        c.m_v += g[i].m_v - coarse[n][i].m_v;
+        change = std::max(change, (c.m_x - next[i].m_x).lpNorm<Eigen::Infinity>());
+        next[i] = c;
+      }
+      coarse[n] = std::move(g);
+    }
+    if (change <= opt.tol) {
+      break;
+    }
+  }
+  return k;
+}
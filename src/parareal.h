@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "particle.h"
+
+/*
+ * Parareal time-parallel integration (Lions, Maday, Turinici 2001).
+ *
+ * The time span is cut in slices of dt. A coarse propagator G (the serial
+ * engine with few substeps) is cheap and sequential; the fine propagator F
+ * (the same engine with all the substeps) is exact but expensive. Starting
+ * from a coarse pass, each parareal iteration runs F on every slice in
+ * parallel, from the current estimate of the slice's initial state, then
+ * corrects the estimates sequentially:
+ *
+ *   U[n+1] = F(U_old[n]) + (G(U[n]) - G(U_old[n]))
+ *
+ * After k iterations the first k slices are exact, so it always converges
+ * in at most `slices` iterations; it stops earlier once no position moved
+ * by more than `tol` during an iteration. The speedup is bounded by the
+ * number of slices divided by the number of iterations.
+ */
+struct PararealOptions {
+  int fine_substeps = 10;
+  int coarse_substeps = 1;
+  double tol = 1e-9;       // on particle positions, negative to never stop early
+  int max_iterations = 0;  // 0: up to the number of slices
+};
+
+// states[0] is the initial state; fills states[1] to states[slices], the
+// state after each slice of dt. Returns the number of iterations.
+int parareal(std::vector<std::vector<Particle>>& states, int slices, double dt, const PararealOptions& opt);
@@ -26,11 +26,43 @@ struct Particle {
     return k * m_q / r;
   };
 
+  // Comme potential_at, en ajoutant à `e` le champs électrique -grad(V) de
+  // la particule. La différence, sa norme et le potentiel sont partagés:
+  // E = V / ((r + 1e-2) * r) * (loc - x).
+  inline double potential_and_field_at(const Vector2d& loc, Vector2d& e) const {
+    Vector2d d = loc - m_x;
+    double r = d.norm();
+    double rs = r + 1e-2;
+    double v = k * m_q / rs;
+    // le champs est indéfini sur la charge elle-même
+    if (r > 0) {
+      e += v / (rs * r) * d;
+    }
+    return v;
+  };
+
   // Calcule la force que l'autre particule exerice sur celle-ci
   inline Vector2d force(const Particle& o) const {
-    Vector2d dir = m_x - o.m_x;            // direction
-    double r = dir.norm() + eps;           // distance
-    double f = k * o.m_q * m_q / (r * r);  // loi de coulomb
+    return coulomb_force(m_x, m_q, o.m_x, o.m_q);
+  };
+
+  // Force exercée par une charge q_o en x_o sur une charge q en x. Permet
+  // de calculer la force à partir de positions stockées hors des particules.
+  static inline Vector2d coulomb_force(const Vector2d& x, double q, const Vector2d& x_o, double q_o) {
+    Vector2d dir = x - x_o;            // direction
+    double r = dir.norm() + eps;       // distance
+    double f = k * q_o * q / (r * r);  // loi de coulomb
+    return f * dir.normalized();
+  };
+
+  // Comme coulomb_force, en ajoutant à `energy` l'énergie potentielle de la
+  // paire calculée avec la même distance: k * q * q_o / (r + eps), dont la
+  // dérivée donne la force adoucie.
+  static inline Vector2d coulomb_force(const Vector2d& x, double q, const Vector2d& x_o, double q_o, double& energy) {
+    Vector2d dir = x - x_o;            // direction
+    double r = dir.norm() + eps;       // distance
+    double f = k * q_o * q / (r * r);  // loi de coulomb
+    energy += k * q_o * q / r;
     return f * dir.normalized();
   };
 
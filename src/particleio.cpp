@@ -0,0 +1,212 @@
+#include "particleio.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+const int fields = 5;
+const size_t header_size = 4 + sizeof(std::int64_t);
+const size_t block_particles = 1 << 16;
+
+// Read-only mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      ::close(fd);
+      throw std::runtime_error("cannot stat " + path);
+    }
+    m_size = st.st_size;
+    if (m_size > 0) {
+      void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("cannot map " + path);
+      }
+      m_data = static_cast<const char*>(data);
+      // the whole file is read at once
+      ::madvise(data, m_size, MADV_WILLNEED);
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (m_data) {
+      ::munmap(const_cast<char*>(m_data), m_size);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const {
+    return m_data;
+  }
+
+  size_t size() const {
+    return m_size;
+  }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+void load_binary(const std::string& path, const MappedFile& file, std::vector<Particle>& particles) {
+  std::int64_t count;
+  if (file.size() < header_size || std::memcmp(file.data(), "PRT1", 4) != 0) {
+    throw std::runtime_error(path + ": not a particle file");
+  }
+  std::memcpy(&count, file.data() + 4, sizeof(count));
+  size_t record_size = fields * sizeof(double);
+  if (count == -1) {
+    // written to a pipe: every record up to the end
+    if ((file.size() - header_size) % record_size != 0) {
+      throw std::runtime_error(path + ": truncated particle file");
+    }
+    count = (file.size() - header_size) / record_size;
+  }
+  if (count < 0 || size_t(count) > (file.size() - header_size) / record_size) {
+    throw std::runtime_error(path + ": truncated particle file");
+  }
+
+  const char* records = file.data() + header_size;
+  size_t first = particles.size();
+  particles.resize(first + count, Particle({0, 0}, {0, 0}, 0));
+  tbb::parallel_for(tbb::blocked_range<std::int64_t>(0, count, 4096),
+                    [&](const tbb::blocked_range<std::int64_t>& r) {
+                      for (std::int64_t i = r.begin(); i < r.end(); i++) {
+                        // the records are not aligned after the 12-byte header
+                        double v[fields];
+                        std::memcpy(v, records + i * sizeof(v), sizeof(v));
+                        particles[first + i] = Particle({v[0], v[1]}, {v[2], v[3]}, v[4]);
+                      }
+                    });
+}
+
+void load_csv(const std::string& path, const MappedFile& file, std::vector<Particle>& particles) {
+  const char* pos = file.data();
+  const char* end = pos + file.size();
+  int line = 0;
+  while (pos < end) {
+    const char* eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    if (!eol) {
+      eol = end;
+    }
+    line++;
+    std::string_view text(pos, eol - pos);
+    pos = eol + 1;
+    if (!text.empty() && text.back() == '\r') {
+      text.remove_suffix(1);
+    }
+    if (text.empty()) {
+      continue;
+    }
+
+    double v[fields];
+    const char* p = text.data();
+    const char* stop = text.data() + text.size();
+    int n = 0;
+    for (; n < fields; n++) {
+      while (p < stop && *p == ' ') {
+        p++;
+      }
+      auto [next, ec] = std::from_chars(p, stop, v[n]);
+      if (ec != std::errc()) {
+        break;
+      }
+      p = next;
+      while (p < stop && *p == ' ') {
+        p++;
+      }
+      if (n < fields - 1) {
+        if (p == stop || *p != ',') {
+          break;
+        }
+        p++;
+      }
+    }
+    if (n == 0 && line == 1) {
+      continue;  // header
+    }
+    if (n < fields || p != stop) {
+      std::ostringstream msg;
+      msg << path << ":" << line << ": expected x,y,vx,vy,q";
+      throw std::runtime_error(msg.str());
+    }
+    particles.push_back(Particle({v[0], v[1]}, {v[2], v[3]}, v[4]));
+  }
+}
+
+}  // namespace
+
+void load_particles(const std::string& path, std::vector<Particle>& particles) {
+  MappedFile file(path);
+  if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0) {
+    load_csv(path, file, particles);
+  } else {
+    load_binary(path, file, particles);
+  }
+}
+
+ParticleWriter::ParticleWriter(std::ostream& ofs) : m_ofs(ofs) {
+  m_header = m_ofs.tellp();
+  // unknown count until finish() patches it, if it can seek back
+  std::int64_t unknown = -1;
+  m_ofs.write("PRT1", 4);
+  m_ofs.write(reinterpret_cast<const char*>(&unknown), sizeof(unknown));
+  m_block.reserve(block_particles * fields);
+}
+
+ParticleWriter::~ParticleWriter() {
+  if (!m_finished) {
+    finish();
+  }
+}
+
+void ParticleWriter::write(const Particle& p) {
+  m_block.insert(m_block.end(), {p.m_x(0), p.m_x(1), p.m_v(0), p.m_v(1), p.m_q});
+  m_count++;
+  if (m_block.size() >= block_particles * fields) {
+    flush();
+  }
+}
+
+void ParticleWriter::write(const std::vector<Particle>& particles) {
+  for (const Particle& p : particles) {
+    write(p);
+  }
+}
+
+void ParticleWriter::flush() {
+  m_ofs.write(reinterpret_cast<const char*>(m_block.data()), m_block.size() * sizeof(double));
+  m_block.clear();
+}
+
+void ParticleWriter::finish() {
+  flush();
+  if (m_header != std::ostream::pos_type(-1)) {
+    std::ostream::pos_type end = m_ofs.tellp();
+    m_ofs.seekp(m_header + std::streamoff(4));
+    m_ofs.write(reinterpret_cast<const char*>(&m_count), sizeof(m_count));
+    m_ofs.seekp(end);
+  }
+  m_ofs.flush();
+  m_finished = true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "particle.h"
+
+/*
+ * Particle files.
+ *
+ * Binary format, little-endian:
+ *
+ *   char     magic[4]    "PRT1"
+ *   int64    count       -1 if unknown: the records go to the end of the file
+ *   float64  data[count][5]   x, y, vx, vy, q
+ *
+ * The file is memory-mapped and the records are decoded in parallel
+ * directly into the particle vector. The CSV format has one particle per
+ * line, "x,y,vx,vy,q"; a first line that does not start with a number is
+ * a header and is skipped. Errors throw std::runtime_error.
+ */
+
+// Append the particles of a binary or CSV file (by extension ".csv")
+void load_particles(const std::string& path, std::vector<Particle>& particles);
+
+// Write particles one block at a time. On a seekable stream, the count is
+// patched into the header by finish(); on a pipe it stays -1 and the
+// reader takes all the records up to the end of the file.
+class ParticleWriter {
+public:
+  explicit ParticleWriter(std::ostream& ofs);
+  ~ParticleWriter();
+
+  void write(const Particle& p);
+  void write(const std::vector<Particle>& particles);
+
+  // Flush the last block and write the count
+  void finish();
+
+private:
+  void flush();
+
+  std::ostream& m_ofs;
+  std::ostream::pos_type m_header;  // -1 if the stream is not seekable
+  std::int64_t m_count = 0;
+  std::vector<double> m_block;
+  bool m_finished = false;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/*
+ * Philox4x32-10 counter-based random number generator (Salmon et al.,
+ * "Parallel random numbers: as easy as 1, 2, 3", SC 2011).
+ *
+ * The output is a pure function of a 128-bit counter and a 64-bit key:
+ * there is no state to share or to advance, so particle i can draw its
+ * values from counter i on any thread and get the same numbers whatever
+ * the number of threads.
+ */
+class Philox4x32 {
+public:
+  using Counter = std::array<std::uint32_t, 4>;
+
+  static Counter generate(Counter c, std::uint64_t key) {
+    std::uint32_t k0 = std::uint32_t(key);
+    std::uint32_t k1 = std::uint32_t(key >> 32);
+    for (int round = 0; round < 10; round++) {
+      if (round > 0) {
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+      }
+      std::uint64_t p0 = std::uint64_t(0xD2511F53) * c[0];
+      std::uint64_t p1 = std::uint64_t(0xCD9E8D57) * c[2];
+      c = {std::uint32_t(p1 >> 32) ^ c[1] ^ k0, std::uint32_t(p1), std::uint32_t(p0 >> 32) ^ c[3] ^ k1,
+           std::uint32_t(p0)};
+    }
+    return c;
+  }
+
+  // Uniform double in [0, 1) from the high 53 bits of two words
+  static double uniform(std::uint32_t hi, std::uint32_t lo) {
+    std::uint64_t bits = (std::uint64_t(hi) << 32 | lo) >> 11;
+    return bits * 0x1.0p-53;
+  }
+};
@@ -1,6 +1,11 @@
 #include "potential.h"
 
 #include <format>
+#include <memory>
+
+#include "checkpoint.h"
+#include "fieldio.h"
+#include "morton.h"
 
 void IPotential::run(std::vector<Particle>& particles, int max_iter, double dt, int substeps, bool update_scale,
                      ColorMap& cmap, std::string outfmt, bool verbose) {
@@ -8,14 +13,101 @@ void IPotential::run(std::vector<Particle>& particles, int max_iter, double dt,
   int iter = 0;
   double lo;
   double hi;
+  m_verbose = verbose;
+  m_image.format = image_format(outfmt);
 
-  // Définir l'échelle de couleurs et sauvegarder la solution initiale
-  compute_field(particles, lo, hi);
-  cmap.update_scale(lo, hi);
-  {
+  // Les particules reçues sont dans l'ordre d'origine, quel que soit le
+  // nombre de particules de l'appel précédent
+  m_ids.clear();
+
+  // Reprendre au dernier point de reprise: l'image de cette itération
+  // existe déjà
+  bool restarted = false;
+  if (m_restart && !m_checkpoint.empty()) {
+    Checkpoint cp;
+    if (read_checkpoint(m_checkpoint, cp)) {
+      particles = std::move(cp.particles);
+      m_ids = std::move(cp.ids);
+      iter = cp.iter;
+      time = cp.time;
+      cmap.set_scale(cp.lo, cp.hi);
+      restarted = true;
+      std::cout << "restart: iter " << iter << " time " << time << std::endl;
+    }
+  }
+  CheckpointWriter checkpoints(m_checkpoint);
+
+  // Un flux (Y4M, APNG) reçoit toutes les images; sinon, un fichier par
+  // image d'après le gabarit. "-" est la sortie standard. Après un
+  // redémarrage, la suite va dans un nouveau fichier (voir stream_path).
+  bool streaming = !outfmt.empty() && is_stream(m_image.format);
+  std::ofstream video;
+  std::unique_ptr<FrameStream> stream;
+  if (streaming) {
+    std::string path = stream_path(outfmt, restarted ? iter + 1 : iter);
+    video.open(path, std::ios::binary);
+    if (!video) {
+      std::cerr << "cannot open " << path << std::endl;
+    }
+    // l'APNG annonce le nombre d'images dans son en-tête
+    int frames = max_iter - iter + (restarted ? 0 : 1);
+    stream = std::make_unique<FrameStream>(video, m_image, frames);
+  }
+  auto save_frame = [&](int iter) {
+    if (outfmt.empty()) {
+      return;
+    }
+    if (streaming) {
+      if (video) {
+        m_stream = stream.get();
+        save_solution(video, cmap);
+        m_stream = nullptr;
+      }
+      return;
+    }
     std::string fname = std::vformat(outfmt, std::make_format_args(iter));
-    std::ofstream ofs(fname);
+    std::ofstream ofs(fname, std::ios::binary);
     save_solution(ofs, cmap);
+  };
+
+  // De même, les champs bruts vont dans un fichier par itération, ou tous
+  // dans un seul fichier compressé (.fldz). Après un redémarrage, le
+  // fichier précédent reste lisible jusqu'au point de reprise (son index y
+  // est écrit) et la suite va dans un nouveau fichier.
+  std::ofstream rawfile;
+  std::unique_ptr<FieldStore> raw_store;
+  if (is_field_store(m_rawfmt)) {
+    int first = restarted ? iter + 1 : iter;
+    std::string path = field_store_path(m_rawfmt, first);
+    rawfile.open(path, std::ios::binary);
+    if (!rawfile) {
+      std::cerr << "cannot open " << path << std::endl;
+    }
+    raw_store = std::make_unique<FieldStore>(rawfile, m_raw, first);
+  }
+  auto save_raw_frame = [&](int iter) {
+    if (m_rawfmt.empty()) {
+      return;
+    }
+    if (raw_store) {
+      if (rawfile) {
+        m_raw_store = raw_store.get();
+        save_raw(rawfile);
+        m_raw_store = nullptr;
+      }
+      return;
+    }
+    std::string fname = std::vformat(m_rawfmt, std::make_format_args(iter));
+    std::ofstream ofs(fname, std::ios::binary);
+    save_raw(ofs);
+  };
+
+  // Définir l'échelle de couleurs et sauvegarder la solution initiale
+  compute_field(particles, lo, hi);
+  if (!restarted) {
+    cmap.update_scale(lo, hi);
+    save_frame(iter);
+    save_raw_frame(iter);
   }
 
   if (verbose) {
@@ -24,10 +116,37 @@ void IPotential::run(std::vector<Particle>& particles, int max_iter, double dt,
     std::cout << "ho: " << hi << "\n";
   }
 
+  // Parareal: tous les états sont calculés d'avance, la boucle ne fait
+  // que les reprendre
+  int first_iter = iter;
+  std::vector<std::vector<Particle>> states;
+  if (m_parareal && iter < max_iter) {
+    PararealOptions opt = m_parareal_opt;
+    opt.fine_substeps = substeps;
+    states.push_back(particles);
+    int k = parareal(states, max_iter - iter, dt, opt);
+    std::cout << "parareal: " << k << " iterations for " << max_iter - iter << " slices" << std::endl;
+  }
+
   while (iter < max_iter) {
-    std::cout << "iter: " << ++iter << " time: " << time << std::endl;
+    ++iter;
+    if (m_progress) {
+      std::cout << "iter: " << iter << " time: " << time << std::endl;
+    }
     // Déplacement des charges
-    move_particles(particles, dt, substeps);
+    if (m_parareal) {
+      particles = std::move(states[iter - first_iter]);
+    } else {
+      move_particles(particles, dt, substeps);
+    }
+    if (m_reorder > 0 && !m_parareal && iter % m_reorder == 0) {
+      morton_sort(particles, m_ids);
+    }
+    if (m_diagnostics && !m_parareal) {
+      std::cout << std::scientific << "diag: kinetic " << m_diag.kinetic << " potential " << m_diag.potential
+                << " total " << m_diag.kinetic + m_diag.potential << " momentum " << m_diag.momentum.transpose()
+                << std::endl;
+    }
 
     // Mettre à jour la solution
     compute_field(particles, lo, hi);
@@ -37,15 +156,30 @@ void IPotential::run(std::vector<Particle>& particles, int max_iter, double dt,
       cmap.update_scale(lo, hi);
     }
 
-    {
-      std::string fname = std::vformat(outfmt, std::make_format_args(iter));
-      std::ofstream ofs(fname);
-      save_solution(ofs, cmap);
-    }
+    save_frame(iter);
+    save_raw_frame(iter);
 
     // Incrément du temps absolu de la solution
     time = time + dt;
+
+    // Copier l'état, l'écriture se fait pendant les itérations suivantes
+    if (m_checkpoint_every > 0 && !m_checkpoint.empty() && iter % m_checkpoint_every == 0) {
+      checkpoints.submit(Checkpoint{iter, time, cmap.m_lo, cmap.m_hi, particles, m_ids});
+      if (raw_store && rawfile) {
+        raw_store->write_index();
+      }
+    }
   }
+  checkpoints.wait();
+  if (stream) {
+    stream->finish();
+  }
+  if (raw_store) {
+    raw_store->finish();
+  }
+
+  // Rendre les particules dans l'ordre d'origine
+  restore_order(particles, m_ids);
 }
 
 void PotentialSerial::compute_field(std::vector<Particle>& charge, double& lo, double& hi) {
@@ -71,14 +205,29 @@ void PotentialSerial::compute_field(std::vector<Particle>& charge, double& lo, d
 void PotentialSerial::move_particles(std::vector<Particle>& charge, double dt, int substeps) {
   int n = charge.size();
   double ssdt = dt / substeps;
+  m_diag = Diagnostics();
   for (int ss = 0; ss < substeps; ss++) {
+    // Les diagnostics sont pris au dernier sous-pas seulement
+    bool diag = m_diagnostics && ss == substeps - 1;
+
     // Calculer les forces entre les charges
     for (int i = 0; i < n; i++) {
       Particle& c = charge[i];
       Vector2d f = Vector2d::Zero();
-      for (int j = 0; j < n; j++) {
-        if (i != j) {
-          f += c.force(charge[j]);
+      if (diag) {
+        // chaque paire est vue deux fois
+        double u = 0.0;
+        for (int j = 0; j < n; j++) {
+          if (i != j) {
+            f += Particle::coulomb_force(c.m_x, c.m_q, charge[j].m_x, charge[j].m_q, u);
+          }
+        }
+        m_diag.potential += 0.5 * u;
+      } else {
+        for (int j = 0; j < n; j++) {
+          if (i != j) {
+            f += c.force(charge[j]);
+          }
         }
       }
       c.m_f = f;
@@ -87,6 +236,10 @@ void PotentialSerial::move_particles(std::vector<Particle>& charge, double dt, i
     // On déplace ensuite les charges
     for (int i = 0; i < n; i++) {
       Particle& c = charge[i];
+      if (diag) {
+        m_diag.kinetic += 0.5 * c.m_v.squaredNorm();
+        m_diag.momentum += c.m_v;
+      }
       // mettre à jour la vitesse en fonction de l'accélération
       c.m_v += c.m_f * ssdt;
 
@@ -108,5 +261,17 @@ void PotentialSerial::save_solution(std::ostream& ofs, ColorMap& cmap) {
       m_img.set_pixel(j, m_height - i - 1, pix);
     }
   }
-  m_img.write_stream(ofs);
+  if (m_stream) {
+    m_stream->write(m_img);
+  } else {
+    write_image(ofs, m_img, m_image);
+  }
+}
+
+void PotentialSerial::save_raw(std::ostream& ofs) {
+  if (m_raw_store) {
+    m_raw_store->write(m_width, m_height, {m_sol.data()});
+  } else {
+    write_raw_field(ofs, m_width, m_height, {m_sol.data()});
+  }
 }
@@ -3,12 +3,28 @@
 #include <Eigen/Dense>
 
 #include "colormap.h"
+#include "fieldio.h"
+#include "imageio.h"
+#include "parareal.h"
 #include "particle.h"
 
 // Macro qui calcule l'indice dans un tableau
 // linéaire qui correspond à un indice 2D.
 #define IDX2(i, j, w) (i * w + j)
 
+// Diagnostics de santé de la simulation, pris au début du dernier sous-pas
+// de move_particles (positions et vitesses au même instant). La masse des
+// particules est unitaire.
+struct Diagnostics {
+  double kinetic = 0.0;                  // énergie cinétique
+  double potential = 0.0;                // énergie potentielle des paires
+  Vector2d momentum = Vector2d::Zero();  // quantité de mouvement
+
+  Diagnostics combine(const Diagnostics& o) const {
+    return Diagnostics{kinetic + o.kinetic, potential + o.potential, momentum + o.momentum};
+  }
+};
+
 class IPotential {
 public:
   // Le destructeur doit être virtuel pour une classe de base
@@ -23,11 +39,61 @@ public:
   // Sauvegarder le champs du potentiel électrique courant dans une image
   virtual void save_solution(std::ostream& ofs, ColorMap& cmap) = 0;
 
+  // Sauvegarder le champs courant en valeurs brutes (voir fieldio.h)
+  virtual void save_raw(std::ostream& ofs) = 0;
+
   // Exécuter la simulation au complet
   // Oui, il y a beaucoup d'arguments, ce serait sans doute mieux de faire une
   // structure, mais bon, ça marche ;-)
   void run(std::vector<Particle>& particles, int max_iter, double dt, int substeps, bool update_scale, ColorMap& cmap,
            std::string outfmt, bool verbose);
+
+  // Mode verbeux de la simulation en cours, les moteurs peuvent s'en servir
+  bool m_verbose = false;
+
+  // Afficher le numéro de chaque itération (désactivé dans les ensembles)
+  bool m_progress = true;
+
+  // Calculer les diagnostics pendant move_particles, à partir des distances
+  // déjà calculées pour les forces, et les afficher à chaque itération
+  bool m_diagnostics = false;
+  Diagnostics m_diag;
+
+  // Gabarit des fichiers de champs bruts, aucun si vide (de même, un
+  // gabarit d'images vide n'écrit aucune image). Un gabarit en .fldz est un
+  // seul fichier compressé de toutes les itérations (voir fieldio.h).
+  std::string m_rawfmt;
+  FieldStoreOptions m_raw;
+
+  // Fichier compressé de run(): save_raw y ajoute le champs
+  FieldStore* m_raw_store = nullptr;
+
+  // Encodage des images; run() choisit le format d'après l'extension du
+  // gabarit (.ppm, .qoi, .y4m, .apng, sinon PNG, voir imageio.h)
+  ImageOptions m_image;
+
+  // Flux de toutes les images de run() (Y4M, APNG): save_solution y ajoute
+  // l'image au lieu de l'encoder seule
+  FrameStream* m_stream = nullptr;
+
+  // Réordonner les particules selon l'ordre de Morton toutes les
+  // m_reorder itérations (0: jamais). m_ids[i] est l'indice d'origine de
+  // la particule i; run() rend les particules dans l'ordre d'origine.
+  int m_reorder = 0;
+  std::vector<int> m_ids;
+
+  // Point de reprise (voir checkpoint.h): fichier, écrit en arrière-plan
+  // toutes les m_checkpoint_every itérations (0: jamais), et relu au début
+  // de run() si m_restart.
+  std::string m_checkpoint;
+  int m_checkpoint_every = 0;
+  bool m_restart = false;
+
+  // Intégrer toutes les itérations d'avance par parareal (voir parareal.h),
+  // le nombre de sous-pas de run() étant celui du propagateur fin. Les
+  // diagnostics et l'ordre de Morton ne sont pas disponibles dans ce mode.
+  bool m_parareal = false;
+  PararealOptions m_parareal_opt;
 };
 
 class PotentialSerial : public IPotential {
@@ -39,6 +105,7 @@ public:
   void compute_field(std::vector<Particle>& charge, double& lo, double& hi) override;
   void move_particles(std::vector<Particle>& charge, double dt, int substeps) override;
   void save_solution(std::ostream& ofs, ColorMap& cmap) override;
+  void save_raw(std::ostream& ofs) override;
 
   int m_width;
   int m_height;
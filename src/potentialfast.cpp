@@ -0,0 +1,40 @@
+#include "potentialfast.h"
+
+#include <bit>
+#include <cstdint>
+
+// Estimate of 1/sqrt(x) for x >= 0, refined by N Newton iterations.
+// For x = 0 the estimate is large but finite, so x * rsqrt(x) stays 0.
+template <int N>
+static inline double fast_rsqrt(double x) {
+  double y = std::bit_cast<double>(0x5fe6eb50c7b537a9ull - (std::bit_cast<std::uint64_t>(x) >> 1));
+  for (int it = 0; it < N; it++) {
+    y = y * (1.5 - 0.5 * x * y * y);
+  }
+  return y;
+}
+
+template <int N>
+static void sweep_row_fast(double* row, const double* dx2, double dy2, double kq, int width) {
+  for (int j = 0; j < width; j++) {
+    double u = dx2[j] + dy2;
+    double r = u * fast_rsqrt<N>(u) + 1e-2;
+    row[j] += kq * fast_rsqrt<N>(r * r);
+  }
+}
+
+void PotentialFast::sweep_row(double* row, const double* dx2, double dy2, double kq) const {
+  // the number of iterations is a template argument so that the inner
+  // loop is fully unrolled and vectorized
+  switch (m_newton) {
+    case 1:
+      sweep_row_fast<1>(row, dx2, dy2, kq, m_width);
+      break;
+    case 2:
+      sweep_row_fast<2>(row, dx2, dy2, kq, m_width);
+      break;
+    default:
+      sweep_row_fast<3>(row, dx2, dy2, kq, m_width);
+      break;
+  }
+}
@@ -0,0 +1,142 @@
+#include "potentialfft.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+#include <cmath>
+
+void PotentialFFT::forward(std::vector<std::complex<double>>& a, int rows) {
+  // rows beyond `rows` are zero and stay zero after their own transform
+  tbb::parallel_for(tbb::blocked_range<int>(0, rows), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      m_fftx.transform(&a[IDX2(i, 0, m_nx)], false);
+    }
+  });
+  tbb::parallel_for(tbb::blocked_range<int>(0, m_nx), [&](const tbb::blocked_range<int>& r) {
+    static thread_local std::vector<std::complex<double>> col;
+    col.resize(m_ny);
+    for (int j = r.begin(); j < r.end(); j++) {
+      for (int i = 0; i < m_ny; i++) {
+        col[i] = a[IDX2(i, j, m_nx)];
+      }
+      m_ffty.transform(col.data(), false);
+      for (int i = 0; i < m_ny; i++) {
+        a[IDX2(i, j, m_nx)] = col[i];
+      }
+    }
+  });
+}
+
+void PotentialFFT::inverse(std::vector<std::complex<double>>& a, int rows) {
+  tbb::parallel_for(tbb::blocked_range<int>(0, m_nx), [&](const tbb::blocked_range<int>& r) {
+    static thread_local std::vector<std::complex<double>> col;
+    col.resize(m_ny);
+    for (int j = r.begin(); j < r.end(); j++) {
+      for (int i = 0; i < m_ny; i++) {
+        col[i] = a[IDX2(i, j, m_nx)];
+      }
+      m_ffty.transform(col.data(), true);
+      for (int i = 0; i < m_ny; i++) {
+        a[IDX2(i, j, m_nx)] = col[i];
+      }
+    }
+  });
+  // only the rows that overlap the image are needed
+  tbb::parallel_for(tbb::blocked_range<int>(0, rows), [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      m_fftx.transform(&a[IDX2(i, 0, m_nx)], true);
+    }
+  });
+}
+
+void PotentialFFT::compute_field(std::vector<Particle>& charge, double& lo, double& hi) {
+  int n = charge.size();
+
+  // The kernel depends only on the resolution: sample k / (r + 1e-2) for
+  // every pixel offset, negative offsets wrapped around, and transform once.
+  if (m_kernel.empty()) {
+    m_kernel.assign(m_nx * m_ny, 0.0);
+    tbb::parallel_for(tbb::blocked_range<int>(-(m_height - 1), m_height), [&](const tbb::blocked_range<int>& r) {
+      for (int di = r.begin(); di < r.end(); di++) {
+        double dy = 1.0 * di / m_height;
+        int i = (di + m_ny) % m_ny;
+        for (int dj = -(m_width - 1); dj < m_width; dj++) {
+          double dx = 1.0 * dj / m_width;
+          int j = (dj + m_nx) % m_nx;
+          m_kernel[IDX2(i, j, m_nx)] = k / (std::sqrt(dx * dx + dy * dy) + 1e-2);
+        }
+      }
+    });
+    forward(m_kernel, m_ny);
+  }
+
+  m_grid.resize(m_nx * m_ny);
+  tbb::parallel_for(tbb::blocked_range<int>(0, m_ny), [&](const tbb::blocked_range<int>& r) {
+    std::fill(m_grid.begin() + r.begin() * m_nx, m_grid.begin() + r.end() * m_nx, 0.0);
+  });
+
+  // Deposit: O(n) and cheap next to the transforms, done serially to
+  // avoid concurrent updates of the same pixel.
+  std::vector<int> outside;
+  for (int c = 0; c < n; c++) {
+    const Particle& p = charge[c];
+    double gx = p.m_x(0) * m_width;
+    double gy = p.m_x(1) * m_height;
+    if (!m_cic) {
+      long j = std::lround(gx);
+      long i = std::lround(gy);
+      if (i >= 0 && i < m_height && j >= 0 && j < m_width) {
+        m_grid[IDX2(i, j, m_nx)] += p.m_q;
+      } else {
+        outside.push_back(c);
+      }
+    } else {
+      double fj = std::floor(gx);
+      double fi = std::floor(gy);
+      if (fi >= 0 && fi + 1 < m_height && fj >= 0 && fj + 1 < m_width) {
+        int i = fi;
+        int j = fj;
+        double wx = gx - fj;
+        double wy = gy - fi;
+        m_grid[IDX2(i, j, m_nx)] += p.m_q * (1 - wx) * (1 - wy);
+        m_grid[IDX2(i, (j + 1), m_nx)] += p.m_q * wx * (1 - wy);
+        m_grid[IDX2((i + 1), j, m_nx)] += p.m_q * (1 - wx) * wy;
+        m_grid[IDX2((i + 1), (j + 1), m_nx)] += p.m_q * wx * wy;
+      } else {
+        outside.push_back(c);
+      }
+    }
+  }
+
+  forward(m_grid, m_height);
+  tbb::parallel_for(tbb::blocked_range<int>(0, m_nx * m_ny), [&](const tbb::blocked_range<int>& r) {
+    for (int p = r.begin(); p < r.end(); p++) {
+      m_grid[p] *= m_kernel[p];
+    }
+  });
+  inverse(m_grid, m_height);
+
+  double scale = 1.0 / (1.0 * m_nx * m_ny);
+  auto lohi = tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, m_height), LoHi(),
+      [&](tbb::blocked_range<int> r, LoHi local_lohi) {
+        for (int i = r.begin(); i < r.end(); i++) {
+          for (int j = 0; j < m_width; j++) {
+            double x = 1.0 * j / m_width;
+            double y = 1.0 * i / m_height;
+
+            double v = m_grid[IDX2(i, j, m_nx)].real() * scale;
+            for (int c : outside) {
+              v += charge[c].potential_at({x, y});
+            }
+            m_sol[IDX2(i, j, m_width)] = v;
+            local_lohi.lo = std::min(local_lohi.lo, v);
+            local_lohi.hi = std::max(local_lohi.hi, v);
+          }
+        }
+        return local_lohi;
+      },
+      [](const LoHi& a, const LoHi& b) { return a.combine(b); });
+  lo = lohi.lo;
+  hi = lohi.hi;
+}
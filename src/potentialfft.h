@@ -0,0 +1,45 @@
+#pragma once
+
+#include <complex>
+
+#include "fft.h"
+#include "potentialparallel.h"
+
+/*
+ * Field engine based on a convolution.
+ *
+ * The field sampled on the pixel grid is the sum over charges of
+ * k * q / (r + 1e-2), i.e. the convolution of a charge density deposited
+ * on the same grid with that kernel. The charges are deposited on the
+ * m_width x m_height grid (nearest pixel or cloud-in-cell), the grid is
+ * zero-padded to avoid wrap-around and convolved with the kernel through
+ * FFT. The cost no longer depends on the number of charges.
+ *
+ * Charges outside the image (or whose cloud overlaps its border) cannot be
+ * deposited; their contribution is added exactly, like the direct engines.
+ */
+class PotentialFFT : public PotentialParallel {
+public:
+  PotentialFFT(int width_, int height_, bool cic_ = false)
+      : PotentialParallel(width_, height_),
+        m_cic(cic_),
+        m_nx(FFT::next_pow2(2 * width_)),
+        m_ny(FFT::next_pow2(2 * height_)),
+        m_fftx(m_nx),
+        m_ffty(m_ny) {
+  }
+
+  void compute_field(std::vector<Particle>& charge, double& lo, double& hi) override;
+
+  bool m_cic;  // cloud-in-cell deposit instead of nearest pixel
+  int m_nx;    // padded grid size
+  int m_ny;
+  FFT m_fftx;
+  FFT m_ffty;
+  std::vector<std::complex<double>> m_kernel;  // transformed kernel, computed once
+  std::vector<std::complex<double>> m_grid;    // padded work grid
+
+private:
+  void forward(std::vector<std::complex<double>>& a, int rows);
+  void inverse(std::vector<std::complex<double>>& a, int rows);
+};
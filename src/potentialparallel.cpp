@@ -1,10 +1,17 @@
 #include "potentialparallel.h"
 
+#include "fieldio.h"
+
 #include <tbb/blocked_range2d.h>
+#include <tbb/combinable.h>
 #include <tbb/global_control.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 
+#include <atomic>
+#include <iostream>
+#include <thread>
+
 /*
  * Dominique Elias
  * ELID14019800
@@ -12,44 +19,396 @@
  *
  */
 
+void PotentialParallel::first_touch() {
+  // free the previous pages first, and leave the new ones untouched: the
+  // rows of the image are only sized here, their pixels allocated below
+  Field().swap(m_sol);
+  m_sol.resize(m_width * m_height);
+  m_img = png::image<png::rgb_pixel>();
+  m_img.resize(0, m_height);
+  auto touch = [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      std::fill(m_sol.begin() + IDX2(i, 0, m_width), m_sol.begin() + IDX2(i, m_width, m_width), 0.0);
+      // save_solution writes row i of the solution into row m_height - i - 1
+      m_img.get_row(m_height - i - 1) = png::image<png::rgb_pixel>::row_type(m_width);
+    }
+  };
+  if (m_numa) {
+    m_numa->run([&](int node) { tbb::parallel_for(m_numa->rows(node, m_height), touch); });
+  } else {
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_height), touch);
+  }
+  // the rows already have this width, only the image header changes
+  m_img.resize(m_width, m_height);
+}
+
+void PotentialParallel::set_numa(bool enabled) {
+  m_numa = enabled ? std::make_unique<NumaArenas>() : nullptr;
+  // the current pages were touched with the previous partition
+  first_touch();
+}
+
+Execution PotentialParallel::dispatch(const char* phase, Execution choice, Execution fallback) const {
+  Execution exec = m_dispatch ? choice : fallback;
+  if (m_verbose) {
+    std::cout << "dispatch: " << phase << " " << to_string(exec) << "\n";
+  }
+  return exec;
+}
+
+void PotentialParallel::compute_field(std::vector<Particle>& charge, double& lo, double& hi) {
+  if (m_periodic) {
+    compute_field_periodic(charge, lo, hi);
+    return;
+  }
+  int n = charge.size();
+  if (m_efield && m_ex.size() != m_sol.size()) {
+    m_ex = Field(m_sol.size());
+    m_ey = Field(m_sol.size());
+  }
+  auto rows = [&](tbb::blocked_range<int> r, LoHi local_lohi) {
+    for (int i = r.begin(); i < r.end(); i++) {
+      for (int j = 0; j < m_width; j++) {
+        double x = 1.0 * j / m_width;
+        double y = 1.0 * i / m_height;
+
+        double v = 0.0;
+        if (m_efield) {
+          // potential and field in the same sweep over the charges
+          Vector2d e = Vector2d::Zero();
+          for (int k = 0; k < n; k++) {
+            v += charge[k].potential_and_field_at({x, y}, e);
+          }
+          m_ex[IDX2(i, j, m_width)] = e(0);
+          m_ey[IDX2(i, j, m_width)] = e(1);
+        } else {
+          // since n is relativly low, parallalizing here is not worth it
+          for (int k = 0; k < n; k++) {
+            v += charge[k].potential_at({x, y});
+          }
+        }
+        m_sol[IDX2(i, j, m_width)] = v;
+        local_lohi.lo = std::min(local_lohi.lo, v);
+        local_lohi.hi = std::max(local_lohi.hi, v);
+      }
+    }
+    return local_lohi;
+  };
+  auto combine = [](const LoHi& a, const LoHi& b) { return a.combine(b); };
+
+  Execution choice = CostModel::calibrated().field(m_height, m_width, n);
+  if (m_efield && choice == Execution::Charges) {
+    // the charge split only accumulates the potential
+    choice = Execution::Rows;
+  }
+  Execution exec = dispatch("compute_field", choice, Execution::Rows);
+  m_efield_valid = m_efield;
+  if (exec == Execution::Charges) {
+    compute_field_by_charges(charge, lo, hi);
+    return;
+  }
+
+  LoHi lohi;
+  if (exec == Execution::Serial) {
+    lohi = rows(tbb::blocked_range<int>(0, m_height), LoHi());
+  } else if (m_numa) {
+    // each node reduces its own band of rows, then the bands are combined
+    std::vector<LoHi> node_lohi(m_numa->size());
+    m_numa->run([&](int node) {
+      auto band = m_numa->rows(node, m_height);
+      node_lohi[node] =
+          tbb::parallel_reduce(tbb::blocked_range<int>(band.begin(), band.end(), m_row_grain), LoHi(), rows, combine);
+    });
+    for (const LoHi& l : node_lohi) {
+      lohi = lohi.combine(l);
+    }
+  } else {
+    lohi = tbb::parallel_reduce(tbb::blocked_range<int>(0, m_height, m_row_grain), LoHi(), rows, combine);
+  }
+  lo = lohi.lo;
+  hi = lohi.hi;
+}
+
 /*
- * since parallel reduce can only return one variable,
- * this struct is essential to combine the two variables
- * that are dependent inside the parallel reduce
+ * Partial field of a subset of the charges over the whole image. The
+ * grid is only allocated when the body first receives work, so stolen
+ * bodies that never run cost nothing; join() adds the grids, and the
+ * joins of parallel_reduce form a reduction tree.
  */
-struct LoHi {
-  double lo;
-  double hi;
+struct PartialField {
+  const PotentialParallel& engine;
+  const std::vector<Particle>& charge;
+  std::vector<double> grid;
+
+  PartialField(const PotentialParallel& engine_, const std::vector<Particle>& charge_)
+      : engine(engine_), charge(charge_) {
+  }
 
-  // Initial value for parallel reduce
-  LoHi() : lo(std::numeric_limits<double>::max()), hi(std::numeric_limits<double>::min()) {
+  PartialField(PartialField& other, tbb::split) : engine(other.engine), charge(other.charge) {
   }
 
-  // used inside combine
-  LoHi(double low, double high) : lo(low), hi(high) {
+  void operator()(const tbb::blocked_range2d<int>& r) {
+    int w = engine.m_width;
+    int h = engine.m_height;
+    if (grid.empty()) {
+      grid.assign(w * h, 0.0);
+    }
+    for (int i = r.rows().begin(); i < r.rows().end(); i++) {
+      for (int j = 0; j < w; j++) {
+        double x = 1.0 * j / w;
+        double y = 1.0 * i / h;
+        double v = 0.0;
+        for (int c = r.cols().begin(); c < r.cols().end(); c++) {
+          v += charge[c].potential_at({x, y});
+        }
+        grid[IDX2(i, j, w)] += v;
+      }
+    }
   }
 
-  // reduce function
-  LoHi combine(const LoHi& other) const {
-    return LoHi(std::min(lo, other.lo), std::max(hi, other.hi));
+  void join(PartialField& other) {
+    if (other.grid.empty()) {
+      return;
+    }
+    if (grid.empty()) {
+      grid.swap(other.grid);
+      return;
+    }
+    for (size_t p = 0; p < grid.size(); p++) {
+      grid[p] += other.grid[p];
+    }
   }
 };
 
-void PotentialParallel::compute_field(std::vector<Particle>& charge, double& lo, double& hi) {
+void PotentialParallel::compute_field_by_charges(std::vector<Particle>& charge, double& lo, double& hi) {
   int n = charge.size();
+  PartialField field(*this, charge);
+  // rows and charges are split together, so each task works on a block of
+  // rows against a block of charges that stays in cache
+  tbb::parallel_reduce(tbb::blocked_range2d<int>(0, m_height, 0, n), field);
+  if (field.grid.empty()) {
+    field.grid.assign(m_width * m_height, 0.0);
+  }
+
   auto lohi = tbb::parallel_reduce(
-      tbb::blocked_range<int>(0, m_height), LoHi(),
-      [&](tbb::blocked_range<int> r, LoHi local_lohi) {
+      tbb::blocked_range<int>(0, m_height * m_width), LoHi(),
+      [&](const tbb::blocked_range<int>& r, LoHi local_lohi) {
+        for (int p = r.begin(); p < r.end(); p++) {
+          m_sol[p] = field.grid[p];
+          local_lohi.lo = std::min(local_lohi.lo, m_sol[p]);
+          local_lohi.hi = std::max(local_lohi.hi, m_sol[p]);
+        }
+        return local_lohi;
+      },
+      [](const LoHi& a, const LoHi& b) { return a.combine(b); });
+  lo = lohi.lo;
+  hi = lohi.hi;
+}
+
+/*
+ * Thresholds of move_particles, in pair interactions per substep.
+ * Without the cost model (m_dispatch off), below serial_pairs one substep
+ * is a few microseconds of arithmetic, less than waking up the workers:
+ * run serially. Up to persistent_pairs, a parallel_for per substep still
+ * costs more than the work it splits: run all the substeps in a single
+ * parallel region instead.
+ */
+static const long serial_pairs = 2048;
+static const long persistent_pairs = 1L << 22;
+
+// Wait until `done` reaches `target`, spinning briefly before yielding
+static void spin_wait(const std::atomic<int>& done, int target) {
+  int spins = 0;
+  while (done.load(std::memory_order_acquire) < target) {
+    if (++spins > 64) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+/*
+ * Positions are double-buffered: substep ss reads every position from
+ * m_pos[ss % 2] and writes the new position of its own particles to
+ * m_pos[(ss + 1) % 2]. Forces and the update of a particle then happen in
+ * the same pass, without racing with threads that read that particle's
+ * position, and a substep needs a single barrier instead of two.
+ */
+void PotentialParallel::move_particles(std::vector<Particle>& charge, double dt, int substeps) {
+  int n = charge.size();
+  double ssdt = dt / substeps;
+  long pairs = 1L * n * n;
+  Execution exec = dispatch("move_particles", CostModel::calibrated().move(n, substeps),
+                            pairs < serial_pairs ? Execution::Serial : Execution::Charges);
+
+  m_pos[0].resize(n);
+  m_pos[1].resize(n);
+  m_q.resize(n);
+  auto load = [&](const tbb::blocked_range<int>& r) {
+    for (int i = r.begin(); i < r.end(); ++i) {
+      m_pos[0][i] = charge[i].m_x;
+      m_q[i] = charge[i].m_q;
+    }
+  };
+  if (pairs < persistent_pairs) {
+    load(tbb::blocked_range<int>(0, n));
+  } else {
+    tbb::parallel_for(tbb::blocked_range<int>(0, n, m_particle_grain), load);
+  }
+  if (m_periodic) {
+    move_particles_periodic(charge, dt, substeps, exec);
+    return;
+  }
+
+  // diagnostics of the last substep, accumulated per thread
+  tbb::combinable<Diagnostics> diag_local;
+
+  double cutoff2 = m_cutoff * m_cutoff;
+  auto step = [&](int ss, int begin, int end) {
+    const std::vector<Vector2d>& x = m_pos[ss % 2];
+    std::vector<Vector2d>& x_next = m_pos[(ss + 1) % 2];
+    bool diag = m_diagnostics && ss == substeps - 1;
+    for (int i = begin; i < end; ++i) {
+      Particle& c = charge[i];
+      Vector2d f = Vector2d::Zero();
+      if (m_cutoff > 0) {
+        // short range: only the listed pairs that are within the cutoff
+        double u = 0.0;
+        for (int k = m_neighbors.m_start[i]; k < m_neighbors.m_start[i + 1]; k++) {
+          int j = m_neighbors.m_index[k];
+          if ((x[i] - x[j]).squaredNorm() < cutoff2) {
+            f += Particle::coulomb_force(x[i], m_q[i], x[j], m_q[j], u);
+          }
+        }
+        if (diag) {
+          Diagnostics& d = diag_local.local();
+          d.potential += 0.5 * u;
+          d.kinetic += 0.5 * c.m_v.squaredNorm();
+          d.momentum += c.m_v;
+        }
+      } else if (diag) {
+        // same distances as the forces; every pair is seen twice
+        double u = 0.0;
+        for (int j = 0; j < n; j++) {
+          if (i != j) {
+            f += Particle::coulomb_force(x[i], m_q[i], x[j], m_q[j], u);
+          }
+        }
+        Diagnostics& d = diag_local.local();
+        d.potential += 0.5 * u;
+        d.kinetic += 0.5 * c.m_v.squaredNorm();
+        d.momentum += c.m_v;
+      } else {
+        for (int j = 0; j < n; j++) {
+          if (i != j) {
+            f += Particle::coulomb_force(x[i], m_q[i], x[j], m_q[j]);
+          }
+        }
+      }
+      c.m_f = f;
+      c.m_v += c.m_f * ssdt;
+      c.m_p = x[i];
+      // nobody reads m_x during the pass, it can be updated in place
+      c.m_x = x[i] + c.m_v * ssdt;
+      x_next[i] = c.m_x;
+    }
+  };
+
+  if (m_cutoff > 0) {
+    // the list is checked between substeps, outside of the step itself
+    for (int ss = 0; ss < substeps; ss++) {
+      const std::vector<Vector2d>& x = m_pos[ss % 2];
+      if (m_neighbors.stale(x, m_cutoff, m_skin, m_particle_grain)) {
+        m_neighbors.build(x, m_cutoff, m_skin, m_particle_grain);
+      }
+      if (exec == Execution::Serial) {
+        step(ss, 0, n);
+      } else {
+        tbb::parallel_for(tbb::blocked_range<int>(0, n, m_particle_grain),
+                          [&](const tbb::blocked_range<int>& r) { step(ss, r.begin(), r.end()); });
+      }
+    }
+  } else if (exec == Execution::Serial) {
+    for (int ss = 0; ss < substeps; ss++) {
+      step(ss, 0, n);
+    }
+  } else if (pairs < persistent_pairs) {
+    move_particles_persistent(n, substeps, step);
+  } else {
+    for (int ss = 0; ss < substeps; ss++) {
+      tbb::parallel_for(tbb::blocked_range<int>(0, n, m_particle_grain),
+                        [&](const tbb::blocked_range<int>& r) { step(ss, r.begin(), r.end()); });
+    }
+  }
+
+  m_diag = diag_local.combine([](const Diagnostics& a, const Diagnostics& b) { return a.combine(b); });
+}
+
+/*
+ * The substeps are a sequence of phases of `chunks` chunks each. Every
+ * chunk of every phase gets a ticket, handed out in order by one atomic
+ * counter; a thread that draws a ticket waits until the previous phase is
+ * complete, runs the chunk, and marks it done.
+ *
+ * The workers are started once for the whole call. A thread only ever
+ * waits for tickets drawn before its own, by threads that are running, so
+ * there is no deadlock even if TBB starts fewer workers than requested:
+ * the threads that are present simply process more chunks.
+ */
+void PotentialParallel::move_particles_persistent(int n, int substeps,
+                                                  const std::function<void(int, int, int)>& step) {
+  int workers = std::min(n, effective_concurrency());
+  int chunks = std::min(n, 4 * workers);
+  int chunk_size = (n + chunks - 1) / chunks;
+  int tickets = substeps * chunks;
+
+  std::atomic<int> next{0};
+  std::vector<std::atomic<int>> done(substeps);
+  tbb::parallel_for(
+      tbb::blocked_range<int>(0, workers, 1),
+      [&](const tbb::blocked_range<int>&) {
+        for (int t = next.fetch_add(1); t < tickets; t = next.fetch_add(1)) {
+          int phase = t / chunks;
+          int begin = (t % chunks) * chunk_size;
+          int end = std::min(n, begin + chunk_size);
+          if (phase > 0) {
+            spin_wait(done[phase - 1], chunks);
+          }
+          step(phase, begin, end);
+          done[phase].fetch_add(1, std::memory_order_release);
+        }
+      },
+      tbb::simple_partitioner());
+}
+
+EwaldPME& PotentialParallel::ewald(int n) {
+  if (!m_ewald || m_ewald->m_charges != n || m_ewald->m_accuracy != m_ewald_accuracy) {
+    m_ewald = std::make_unique<EwaldPME>(n, m_ewald_accuracy);
+    if (m_verbose) {
+      std::cout << "ewald: cutoff " << m_ewald->m_cutoff << " alpha " << m_ewald->m_alpha << " mesh " << m_ewald->m_mesh
+                << "\n";
+    }
+  }
+  return *m_ewald;
+}
+
+void PotentialParallel::compute_field_periodic(std::vector<Particle>& charge, double& lo, double& hi) {
+  int n = charge.size();
+  std::vector<Vector2d> x(n);
+  std::vector<double> q(n);
+  for (int c = 0; c < n; c++) {
+    x[c] = charge[c].m_x;
+    q[c] = charge[c].m_q;
+  }
+  EwaldPME& solver = ewald(n);
+  solver.update(x, q);
+  m_efield_valid = false;
+
+  auto lohi = tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, m_height, m_row_grain), LoHi(),
+      [&](const tbb::blocked_range<int>& r, LoHi local_lohi) {
         for (int i = r.begin(); i < r.end(); i++) {
           for (int j = 0; j < m_width; j++) {
-            double x = 1.0 * j / m_width;
-            double y = 1.0 * i / m_height;
-
-            double v = 0.0;
-            // since n is relativly low, parallalizing here is not worth it
-            for (int k = 0; k < n; k++) {
-              v += charge[k].potential_at({x, y});
-            }
+            double v = solver.potential_at({1.0 * j / m_width, 1.0 * i / m_height});
             m_sol[IDX2(i, j, m_width)] = v;
             local_lohi.lo = std::min(local_lohi.lo, v);
             local_lohi.hi = std::max(local_lohi.hi, v);
@@ -62,35 +421,53 @@ void PotentialParallel::compute_field(std::vector<Particle>& charge, double& lo,
   hi = lohi.hi;
 }
 
-void PotentialParallel::move_particles(std::vector<Particle>& charge, double dt, int substeps) {
+/*
+ * Each substep solves the mesh once from the current positions, then every
+ * particle reads its force from the solver (real-space neighbours and mesh
+ * interpolation) and moves; positions are wrapped back into the unit
+ * square.
+ */
+void PotentialParallel::move_particles_periodic(std::vector<Particle>& charge, double dt, int substeps,
+                                                Execution exec) {
   int n = charge.size();
   double ssdt = dt / substeps;
+  EwaldPME& solver = ewald(n);
+  tbb::combinable<Diagnostics> diag_local;
+
   for (int ss = 0; ss < substeps; ss++) {
-    tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
+    const std::vector<Vector2d>& x = m_pos[ss % 2];
+    std::vector<Vector2d>& x_next = m_pos[(ss + 1) % 2];
+    bool diag = m_diagnostics && ss == substeps - 1;
+    solver.update(x, m_q);
+    auto step = [&](const tbb::blocked_range<int>& r) {
       for (int i = r.begin(); i < r.end(); ++i) {
         Particle& c = charge[i];
-        Vector2d f = Vector2d::Zero();
-        for (int j = 0; j < n; j++) {
-          if (i != j) {
-            f += c.force(charge[j]);
-          }
+        double phi;
+        c.m_f = solver.force(i, phi);
+        if (diag) {
+          Diagnostics& d = diag_local.local();
+          d.potential += 0.5 * m_q[i] * phi;
+          d.kinetic += 0.5 * c.m_v.squaredNorm();
+          d.momentum += c.m_v;
         }
-        c.m_f = f;
-      }
-    });
-    tbb::parallel_for(tbb::blocked_range<int>(0, n), [&](const tbb::blocked_range<int>& r) {
-      for (int i = r.begin(); i < r.end(); ++i) {
-        Particle& c = charge[i];
         c.m_v += c.m_f * ssdt;
-        c.m_p = c.m_x;
-        c.m_x += c.m_v * ssdt;
+        c.m_p = x[i];
+        c.m_x = EwaldPME::wrap(x[i] + c.m_v * ssdt);
+        x_next[i] = c.m_x;
       }
-    });
+    };
+    if (exec == Execution::Serial) {
+      step(tbb::blocked_range<int>(0, n));
+    } else {
+      tbb::parallel_for(tbb::blocked_range<int>(0, n, m_particle_grain), step);
+    }
   }
+
+  m_diag = diag_local.combine([](const Diagnostics& a, const Diagnostics& b) { return a.combine(b); });
 }
 
 void PotentialParallel::save_solution(std::ostream& ofs, ColorMap& cmap) {
-  tbb::parallel_for(tbb::blocked_range2d<int>(0, m_height, 0, m_width), [&](const tbb::blocked_range2d<int>& r) {
+  auto pixels = [&](const tbb::blocked_range2d<int>& r) {
     for (int i = r.rows().begin(); i < r.rows().end(); ++i) {
       for (int j = r.cols().begin(); j < r.cols().end(); ++j) {
         double v = m_sol[IDX2(i, j, m_width)];
@@ -98,6 +475,34 @@ void PotentialParallel::save_solution(std::ostream& ofs, ColorMap& cmap) {
         m_img.set_pixel(j, m_height - i - 1, pix);
       }
     }
-  });
-  m_img.write_stream(ofs);
+  };
+  Execution exec = dispatch("save_solution", CostModel::calibrated().save(1L * m_height * m_width), Execution::Rows);
+  if (exec == Execution::Serial) {
+    pixels(tbb::blocked_range2d<int>(0, m_height, 0, m_width));
+  } else if (m_numa) {
+    m_numa->run([&](int node) {
+      auto band = m_numa->rows(node, m_height);
+      tbb::parallel_for(tbb::blocked_range2d<int>(band.begin(), band.end(), 0, m_width), pixels);
+    });
+  } else {
+    tbb::parallel_for(tbb::blocked_range2d<int>(0, m_height, 0, m_width), pixels);
+  }
+  if (m_stream) {
+    m_stream->write(m_img);
+  } else {
+    write_image(ofs, m_img, m_image);
+  }
+}
+
+void PotentialParallel::save_raw(std::ostream& ofs) {
+  std::vector<const double*> components = {m_sol.data()};
+  if (m_efield_valid) {
+    components.push_back(m_ex.data());
+    components.push_back(m_ey.data());
+  }
+  if (m_raw_store) {
+    m_raw_store->write(m_width, m_height, components);
+  } else {
+    write_raw_field(ofs, m_width, m_height, components);
+  }
 }
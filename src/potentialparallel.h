@@ -1,19 +1,101 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+
+#include "dispatch.h"
+#include "ewald.h"
+#include "neighbors.h"
+#include "numa.h"
 #include "potential.h"
 
+/*
+ * since parallel reduce can only return one variable,
+ * this struct is essential to combine the two variables
+ * that are dependent inside the parallel reduce
+ */
+struct LoHi {
+  double lo;
+  double hi;
+
+  // Initial value for parallel reduce
+  LoHi() : lo(std::numeric_limits<double>::max()), hi(std::numeric_limits<double>::min()) {
+  }
+
+  // used inside combine
+  LoHi(double low, double high) : lo(low), hi(high) {
+  }
+
+  // reduce function
+  LoHi combine(const LoHi& other) const {
+    return LoHi(std::min(lo, other.lo), std::max(hi, other.hi));
+  }
+};
+
+// Potential field buffer, left untouched at allocation (see first_touch)
+using Field = std::vector<double, default_init_allocator<double>>;
+
 class PotentialParallel : public IPotential {
 public:
-  PotentialParallel(int width_, int height_)
-      : m_width(width_), m_height(height_), m_sol(m_width * m_height), m_img(m_width, m_height) {
+  PotentialParallel(int width_, int height_) : m_width(width_), m_height(height_) {
+    first_touch();
   }
 
   void compute_field(std::vector<Particle>& charge, double& lo, double& hi) override;
   void move_particles(std::vector<Particle>& charge, double dt, int substeps) override;
   void save_solution(std::ostream& ofs, ColorMap& cmap) override;
+  void save_raw(std::ostream& ofs) override;
+
+  // compute_field split over charges as well as rows: partial grids of
+  // charge blocks are summed by a tree reduction. For small images with
+  // many charges, where rows alone give too few tasks.
+  void compute_field_by_charges(std::vector<Particle>& charge, double& lo, double& hi);
+
+  // Bind row bands to NUMA nodes (one task_arena per node) and re-allocate
+  // the buffers so their pages land on the node that computes them. Only
+  // the compute_field of this engine follows the bands; the derived
+  // engines use them in save_solution alone.
+  void set_numa(bool enabled);
 
   int m_width;
   int m_height;
-  std::vector<double> m_sol;
+  Field m_sol;
   png::image<png::rgb_pixel> m_img;
+  std::unique_ptr<NumaArenas> m_numa;
+  int m_row_grain = 1;       // grain size of the row loop in compute_field
+  int m_particle_grain = 1;  // grain size of the particle loops in move_particles
+  std::vector<Vector2d> m_pos[2];  // double-buffered positions of move_particles
+  bool m_dispatch = true;          // let the cost model choose serial or parallel per phase
+  bool m_efield = false;           // compute_field also computes the electric field
+  bool m_efield_valid = false;     // m_ex and m_ey match m_sol
+  Field m_ex;
+  Field m_ey;
+  std::vector<double> m_q;         // charges, next to the positions
+  double m_cutoff = 0.0;           // range of the forces in move_particles, 0 for no cutoff
+  double m_skin = 0.05;            // Verlet list margin beyond the cutoff
+  NeighborList m_neighbors;
+  bool m_periodic = false;         // periodic unit square, particle-mesh Ewald (see ewald.h)
+  double m_ewald_accuracy = 1e-4;  // target relative accuracy of the Ewald sums
+  std::unique_ptr<EwaldPME> m_ewald;
+
+protected:
+  // Execution chosen for a phase, printed in verbose mode
+  Execution dispatch(const char* phase, Execution choice, Execution fallback) const;
+
+  // Run all the substeps of move_particles in one parallel region, with a
+  // barrier between substeps (small n). step(ss, begin, end) advances
+  // particles [begin, end) by one substep.
+  void move_particles_persistent(int n, int substeps, const std::function<void(int, int, int)>& step);
+
+  // compute_field and move_particles of the periodic mode
+  void compute_field_periodic(std::vector<Particle>& charge, double& lo, double& hi);
+  void move_particles_periodic(std::vector<Particle>& charge, double dt, int substeps, Execution exec);
+
+  // Ewald solver for n charges, rebuilt when n or the accuracy changes
+  EwaldPME& ewald(int n);
+
+  // Allocate m_sol and the m_img rows, and zero them from the threads that
+  // later write them: row bands per node with NUMA, the default partition
+  // otherwise. The only allocation of both buffers.
+  void first_touch();
 };
@@ -0,0 +1,70 @@
+#include "potentialrowsweep.h"
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+#include <cmath>
+
+void PotentialRowSweep::sweep_row(double* row, const double* dx2, double dy2, double kq) const {
+  for (int j = 0; j < m_width; j++) {
+    row[j] += kq / (std::sqrt(dx2[j] + dy2) + 1e-2);
+  }
+}
+
+void PotentialRowSweep::compute_field(std::vector<Particle>& charge, double& lo, double& hi) {
+  int n = charge.size();
+  int bs = std::max(1, m_block_charges);
+  m_dx2.resize(bs * m_width);
+  m_dy2.resize(bs * m_height);
+  m_kq.resize(bs);
+
+  tbb::parallel_for(tbb::blocked_range<int>(0, m_height), [&](const tbb::blocked_range<int>& r) {
+    std::fill(m_sol.begin() + r.begin() * m_width, m_sol.begin() + r.end() * m_width, 0.0);
+  });
+
+  for (int kb = 0; kb < n; kb += bs) {
+    int nb = std::min(n, kb + bs) - kb;
+
+    // tables of the block: the only place where pixel coordinates are computed
+    tbb::parallel_for(tbb::blocked_range<int>(0, nb), [&](const tbb::blocked_range<int>& r) {
+      for (int c = r.begin(); c < r.end(); c++) {
+        const Particle& p = charge[kb + c];
+        m_kq[c] = k * p.m_q;
+        double* dx2 = &m_dx2[IDX2(c, 0, m_width)];
+        for (int j = 0; j < m_width; j++) {
+          double dx = 1.0 * j / m_width - p.m_x(0);
+          dx2[j] = dx * dx;
+        }
+        double* dy2 = &m_dy2[IDX2(c, 0, m_height)];
+        for (int i = 0; i < m_height; i++) {
+          double dy = 1.0 * i / m_height - p.m_x(1);
+          dy2[i] = dy * dy;
+        }
+      }
+    });
+
+    // charges of the block are added in order, each pixel gets the same
+    // sum as in the serial engine
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_height), [&](const tbb::blocked_range<int>& r) {
+      for (int i = r.begin(); i < r.end(); i++) {
+        double* row = &m_sol[IDX2(i, 0, m_width)];
+        for (int c = 0; c < nb; c++) {
+          sweep_row(row, &m_dx2[IDX2(c, 0, m_width)], m_dy2[IDX2(c, i, m_height)], m_kq[c]);
+        }
+      }
+    });
+  }
+
+  auto lohi = tbb::parallel_reduce(
+      tbb::blocked_range<int>(0, m_height * m_width), LoHi(),
+      [&](const tbb::blocked_range<int>& r, LoHi local_lohi) {
+        for (int p = r.begin(); p < r.end(); p++) {
+          local_lohi.lo = std::min(local_lohi.lo, m_sol[p]);
+          local_lohi.hi = std::max(local_lohi.hi, m_sol[p]);
+        }
+        return local_lohi;
+      },
+      [](const LoHi& a, const LoHi& b) { return a.combine(b); });
+  lo = lohi.lo;
+  hi = lohi.hi;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "potentialparallel.h"
+
+/*
+ * Row-sweep variant of the parallel engine.
+ *
+ * For pixel (i, j), dy only depends on the row and dx only on the column.
+ * For each block of charges, the squared offsets dx^2 (block x width) and
+ * dy^2 (block x height) are tabulated once, so the inner loop over a row
+ * is reduced to add + sqrt + divide and the divisions by m_width and
+ * m_height disappear from it. The inner loop runs over contiguous memory
+ * and is left to the compiler to vectorize.
+ */
+class PotentialRowSweep : public PotentialParallel {
+public:
+  PotentialRowSweep(int width_, int height_, int block_charges_ = 256)
+      : PotentialParallel(width_, height_), m_block_charges(block_charges_) {
+  }
+
+  void compute_field(std::vector<Particle>& charge, double& lo, double& hi) override;
+
+  // Add the contribution of one charge to one row of the image:
+  // row[j] += kq / (sqrt(dx2[j] + dy2) + 1e-2)
+  virtual void sweep_row(double* row, const double* dx2, double dy2, double kq) const;
+
+  int m_block_charges;
+  std::vector<double> m_dx2;  // dx^2, one row of m_width per charge of the block
+  std::vector<double> m_dy2;  // dy^2, one row of m_height per charge of the block
+  std::vector<double> m_kq;   // k * q per charge of the block
+};
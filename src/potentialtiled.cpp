@@ -0,0 +1,51 @@
+#include "potentialtiled.h"
+
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/partitioner.h>
+
+void PotentialTiled::compute_field(std::vector<Particle>& charge, double& lo, double& hi) {
+  int n = charge.size();
+  int tile_charges = std::max(1, m_tile_charges);
+  auto lohi = tbb::parallel_reduce(
+      tbb::blocked_range2d<int>(0, m_height, std::max(1, m_tile_rows), 0, m_width, std::max(1, m_tile_cols)), LoHi(),
+      [&](const tbb::blocked_range2d<int>& r, LoHi local_lohi) {
+        int i0 = r.rows().begin();
+        int j0 = r.cols().begin();
+        int cols = r.cols().size();
+
+        // one tile buffer per thread, reused from one tile to the next
+        static thread_local std::vector<double> tile;
+        tile.assign(r.rows().size() * cols, 0.0);
+
+        // charges are visited in the same order as the serial engine,
+        // so every pixel receives exactly the same sum
+        for (int kb = 0; kb < n; kb += tile_charges) {
+          int ke = std::min(n, kb + tile_charges);
+          for (int i = i0; i < r.rows().end(); i++) {
+            double y = 1.0 * i / m_height;
+            for (int j = j0; j < r.cols().end(); j++) {
+              double x = 1.0 * j / m_width;
+              double v = tile[IDX2((i - i0), (j - j0), cols)];
+              for (int k = kb; k < ke; k++) {
+                v += charge[k].potential_at({x, y});
+              }
+              tile[IDX2((i - i0), (j - j0), cols)] = v;
+            }
+          }
+        }
+
+        for (int i = i0; i < r.rows().end(); i++) {
+          for (int j = j0; j < r.cols().end(); j++) {
+            double v = tile[IDX2((i - i0), (j - j0), cols)];
+            m_sol[IDX2(i, j, m_width)] = v;
+            local_lohi.lo = std::min(local_lohi.lo, v);
+            local_lohi.hi = std::max(local_lohi.hi, v);
+          }
+        }
+        return local_lohi;
+      },
+      [](const LoHi& a, const LoHi& b) { return a.combine(b); }, tbb::simple_partitioner());
+  lo = lohi.lo;
+  hi = lohi.hi;
+}
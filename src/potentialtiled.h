@@ -0,0 +1,28 @@
+#pragma once
+
+#include "potentialparallel.h"
+
+/*
+ * Cache-blocked variant of the parallel engine.
+ *
+ * The plain engine streams every charge for every pixel; once the charge
+ * array no longer fits in L1/L2, each pixel re-reads it from memory. Here
+ * the image is cut into tiles of tile_rows x tile_cols pixels and the
+ * charges into blocks of tile_charges, so one charge block stays hot in
+ * cache while it is applied to a whole tile.
+ */
+class PotentialTiled : public PotentialParallel {
+public:
+  PotentialTiled(int width_, int height_, int tile_rows_ = 32, int tile_cols_ = 32, int tile_charges_ = 256)
+      : PotentialParallel(width_, height_),
+        m_tile_rows(tile_rows_),
+        m_tile_cols(tile_cols_),
+        m_tile_charges(tile_charges_) {
+  }
+
+  void compute_field(std::vector<Particle>& charge, double& lo, double& hi) override;
+
+  int m_tile_rows;
+  int m_tile_cols;
+  int m_tile_charges;
+};
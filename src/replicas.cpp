@@ -0,0 +1,110 @@
+#include "replicas.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <cmath>
+
+ReplicaBatch::ReplicaBatch(int n, int replicas)
+    : m_n(n), m_replicas(replicas), m_batches((replicas + lanes - 1) / lanes) {
+  // the unused lanes of the last batch hold empty systems (q = 0)
+  size_t total = size_t(m_batches) * m_n * lanes;
+  for (std::vector<double>* v : {&m_x[0], &m_x[1], &m_y[0], &m_y[1], &m_vx, &m_vy, &m_fx, &m_fy, &m_q}) {
+    v->assign(total, 0.0);
+  }
+}
+
+void ReplicaBatch::load(int r, const std::vector<Particle>& particles) {
+  int b = r / lanes;
+  int l = r % lanes;
+  for (int i = 0; i < m_n; i++) {
+    size_t idx = offset(b, i) + l;
+    const Particle& c = particles[i];
+    m_x[m_current][idx] = c.m_x(0);
+    m_y[m_current][idx] = c.m_x(1);
+    m_vx[idx] = c.m_v(0);
+    m_vy[idx] = c.m_v(1);
+    m_fx[idx] = c.m_f(0);
+    m_fy[idx] = c.m_f(1);
+    m_q[idx] = c.m_q;
+  }
+}
+
+void ReplicaBatch::store(int r, std::vector<Particle>& particles) const {
+  int b = r / lanes;
+  int l = r % lanes;
+  particles.resize(m_n, Particle({0, 0}, {0, 0}, 0));
+  for (int i = 0; i < m_n; i++) {
+    size_t idx = offset(b, i) + l;
+    Particle& c = particles[i];
+    c.m_x = {m_x[m_current][idx], m_y[m_current][idx]};
+    c.m_p = {m_x[1 - m_current][idx], m_y[1 - m_current][idx]};
+    c.m_v = {m_vx[idx], m_vy[idx]};
+    c.m_f = {m_fx[idx], m_fy[idx]};
+    c.m_q = m_q[idx];
+  }
+}
+
+void ReplicaBatch::move_particles(double dt, int substeps) {
+  double ssdt = dt / substeps;
+  tbb::parallel_for(tbb::blocked_range<int>(0, m_batches, 1), [&](const tbb::blocked_range<int>& r) {
+    for (int b = r.begin(); b < r.end(); b++) {
+      move_batch(b, ssdt, substeps);
+    }
+  });
+  m_current = (m_current + substeps) % 2;
+}
+
+void ReplicaBatch::move_batch(int b, double ssdt, int substeps) {
+  const double* q = m_q.data() + offset(b, 0);
+  double* vx = m_vx.data() + offset(b, 0);
+  double* vy = m_vy.data() + offset(b, 0);
+  double* fx = m_fx.data() + offset(b, 0);
+  double* fy = m_fy.data() + offset(b, 0);
+  for (int ss = 0; ss < substeps; ss++) {
+    int cur = (m_current + ss) % 2;
+    const double* x = m_x[cur].data() + offset(b, 0);
+    const double* y = m_y[cur].data() + offset(b, 0);
+    double* x_next = m_x[1 - cur].data() + offset(b, 0);
+    double* y_next = m_y[1 - cur].data() + offset(b, 0);
+
+    for (int i = 0; i < m_n; i++) {
+      const double* xi = x + i * lanes;
+      const double* yi = y + i * lanes;
+      const double* qi = q + i * lanes;
+      double sx[lanes] = {};
+      double sy[lanes] = {};
+      for (int j = 0; j < m_n; j++) {
+        if (j == i) {
+          continue;
+        }
+        const double* xj = x + j * lanes;
+        const double* yj = y + j * lanes;
+        const double* qj = q + j * lanes;
+        // one replica per lane; same operations as Particle::coulomb_force
+        for (int l = 0; l < lanes; l++) {
+          double dx = xi[l] - xj[l];
+          double dy = yi[l] - yj[l];
+          double d2 = dx * dx + dy * dy;
+          double norm = std::sqrt(d2);
+          double r = norm + eps;
+          double f = k * qj[l] * qi[l] / (r * r);
+          // normalized() leaves a zero vector unchanged: dividing by 1
+          // instead keeps the loop free of branches
+          double unit = d2 > 0 ? norm : 1.0;
+          sx[l] += f * (dx / unit);
+          sy[l] += f * (dy / unit);
+        }
+      }
+      for (int l = 0; l < lanes; l++) {
+        size_t idx = i * lanes + l;
+        fx[idx] = sx[l];
+        fy[idx] = sy[l];
+        vx[idx] += sx[l] * ssdt;
+        vy[idx] += sy[l] * ssdt;
+        x_next[idx] = xi[l] + vx[idx] * ssdt;
+        y_next[idx] = yi[l] + vy[idx] * ssdt;
+      }
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "particle.h"
+
+/*
+ * Replica-batched simulation of many small independent systems.
+ *
+ * All replicas have the same number of particles n. They are grouped in
+ * batches of `lanes` replicas and stored SoA across replicas: the x
+ * coordinate of particle i of the replicas of a batch is `lanes`
+ * contiguous doubles, one per replica. The force loop then runs the same
+ * pair (i, j) on every lane at once, which the compiler turns into SIMD
+ * instructions: one replica per vector lane, with no branch that depends
+ * on the replica.
+ *
+ * Each batch is advanced through all its substeps by one task, so the
+ * threads work on independent batches and a batch stays in cache. The
+ * arithmetic is the same as Particle::coulomb_force and the integration
+ * the same as the other engines, pair by pair.
+ */
+class ReplicaBatch {
+public:
+  static constexpr int lanes = 8;
+
+  ReplicaBatch(int n, int replicas);
+
+  int size() const {
+    return m_replicas;
+  }
+
+  // Copy replica r in or out of the batches (n particles)
+  void load(int r, const std::vector<Particle>& particles);
+  void store(int r, std::vector<Particle>& particles) const;
+
+  // Advance every replica by dt in `substeps` substeps
+  void move_particles(double dt, int substeps);
+
+private:
+  // Offset of particle i of the first lane of batch b in the arrays
+  size_t offset(int b, int i) const {
+    return (size_t(b) * m_n + i) * lanes;
+  }
+
+  void move_batch(int b, double ssdt, int substeps);
+
+  int m_n;
+  int m_replicas;
+  int m_batches;
+  std::vector<double> m_x[2];  // double-buffered positions
+  std::vector<double> m_y[2];
+  std::vector<double> m_vx;
+  std::vector<double> m_vy;
+  std::vector<double> m_fx;
+  std::vector<double> m_fy;
+  std::vector<double> m_q;
+  int m_current = 0;  // buffer holding the current positions
+};
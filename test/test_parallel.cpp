@@ -1,15 +1,41 @@
+#include <autotune.h>
+#include <checkpoint.h>
 #include <colormap.h>
+#include <dispatch.h>
+#include <ensemble.h>
+#include <ewald.h>
+#include <fieldio.h>
+#include <imageio.h>
+#include <morton.h>
+#include <parareal.h>
 #include <particle.h>
+#include <particleio.h>
+#include <philox.h>
 #include <potential.h>
+#include <potentialfast.h>
+#include <potentialfft.h>
 #include <potentialparallel.h>
+#include <potentialrowsweep.h>
+#include <potentialtiled.h>
+#include <replicas.h>
 #include <uqam/tp.h>
 
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include <zlib.h>
+
 #include <catch2/catch_all.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 #include <catch2/matchers/catch_matchers_predicate.hpp>
 #include <catch2/matchers/catch_matchers_quantifiers.hpp>
 #include <catch2/matchers/catch_matchers_range_equals.hpp>
 #include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
 
 #include "experiments.h"
 
@@ -279,3 +305,1621 @@ TEST_CASE("PotentialParallelRandomExperiment") {
   delete serial;
   delete parallel;
 }
+
+TEST_CASE("PotentialTiledRandomExperiment") {
+  int resol = 100;
+  std::string colormap_name(SOURCE_DIR "/data/colormap_parula.png");
+  ColorMap cmap;
+  cmap.load(colormap_name);
+  // plusieurs blocs de charges et des tuiles qui ne divisent pas l'image
+  int numpart = 300;
+
+  PotentialSerial serial(resol, resol);
+  PotentialTiled tiled(resol, resol, 16, 24, 64);
+
+  std::vector<Particle> particles;
+  experiment_random(numpart, particles);
+  double lo_serial, hi_serial;
+  double lo_tiled, hi_tiled;
+
+  serial.compute_field(particles, lo_serial, hi_serial);
+  tiled.compute_field(particles, lo_tiled, hi_tiled);
+
+  CHECK(std::abs(lo_serial - lo_tiled) < abstol);
+  CHECK(std::abs(hi_serial - hi_tiled) < abstol);
+  CHECK(std::equal(serial.m_sol.begin(), serial.m_sol.end(), tiled.m_sol.begin(), tiled.m_sol.end()));
+
+  cmap.update_scale(lo_serial, hi_serial);
+  std::ostringstream oss_serial, oss_tiled;
+  serial.save_solution(oss_serial, cmap);
+  tiled.save_solution(oss_tiled, cmap);
+  CHECK(oss_serial.str() == oss_tiled.str());
+}
+
+TEST_CASE("PotentialRowSweepRandomExperiment") {
+  int resol = 100;
+  int numpart = 300;
+
+  PotentialSerial serial(resol, resol);
+  PotentialRowSweep rowsweep(resol, resol, 64);
+
+  std::vector<Particle> particles;
+  experiment_random(numpart, particles);
+  double lo_serial, hi_serial;
+  double lo_rowsweep, hi_rowsweep;
+
+  serial.compute_field(particles, lo_serial, hi_serial);
+  rowsweep.compute_field(particles, lo_rowsweep, hi_rowsweep);
+
+  CHECK_THAT(lo_rowsweep, Matchers::WithinRel(lo_serial, 1e-12));
+  CHECK_THAT(hi_rowsweep, Matchers::WithinRel(hi_serial, 1e-12));
+  for (size_t p = 0; p < serial.m_sol.size(); p++) {
+    REQUIRE_THAT(rowsweep.m_sol[p], Matchers::WithinRel(serial.m_sol[p], 1e-12));
+  }
+}
+
+TEST_CASE("PotentialFastAccuracy") {
+  int resol = 128;
+  int numpart = 200;
+  std::string colormap_name(SOURCE_DIR "/data/colormap_parula.png");
+  ColorMap cmap;
+  cmap.load(colormap_name);
+
+  std::vector<Particle> particles;
+  experiment_random(numpart, particles);
+
+  PotentialSerial serial(resol, resol);
+  double lo_serial, hi_serial;
+  serial.compute_field(particles, lo_serial, hi_serial);
+  cmap.set_scale(lo_serial, hi_serial);
+  double vmax = std::max(std::abs(lo_serial), std::abs(hi_serial));
+  // sous 1 % de l'amplitude, moins d'un pas de la carte de 64 couleurs,
+  // l'erreur relative n'a plus de sens (les termes s'annulent): elle est
+  // alors bornée par rapport à ce plancher
+  double tiny = 1e-2 * vmax;
+
+  // erreur maximale relative à l'amplitude, erreur relative maximale par
+  // pixel et fraction maximale des pixels dont la couleur change, selon le
+  // nombre d'itérations de Newton: les valeurs mesurées (voir
+  // potentialfast.h) avec une marge d'environ 40 %
+  auto newton = GENERATE(table<int, double, double, double>({
+      {1, 2e-3, 1.2e-1, 5e-2},
+      {2, 5e-6, 3.5e-4, 1e-3},
+      {3, 4e-11, 2.5e-9, 1e-4},
+  }));
+
+  PotentialFast fast(resol, resol, std::get<0>(newton), 64);
+  double lo_fast, hi_fast;
+  fast.compute_field(particles, lo_fast, hi_fast);
+
+  double max_err = 0.0;
+  double max_pixel_err = 0.0;
+  int changed = 0;
+  for (size_t p = 0; p < serial.m_sol.size(); p++) {
+    double ref = serial.m_sol[p];
+    double err = std::abs(fast.m_sol[p] - ref);
+    max_err = std::max(max_err, err / vmax);
+    max_pixel_err = std::max(max_pixel_err, err / std::max(std::abs(ref), tiny));
+    if (cmap.get_index(fast.m_sol[p]) != cmap.get_index(serial.m_sol[p])) {
+      changed++;
+    }
+  }
+  double changed_fraction = 1.0 * changed / serial.m_sol.size();
+
+  INFO("newton: " << std::get<0>(newton) << " max_err: " << max_err << " max_pixel_err: " << max_pixel_err
+                   << " changed: " << changed_fraction);
+  CHECK(max_err < std::get<1>(newton));
+  CHECK(max_pixel_err < std::get<2>(newton));
+  CHECK(changed_fraction <= std::get<3>(newton));
+}
+
+TEST_CASE("PotentialFFTGridCharges") {
+  int resol = 64;
+  bool cic = GENERATE(false, true);
+
+  // Charges placées exactement sur des pixels: le dépôt est exact et la
+  // convolution doit redonner la somme directe. La dernière charge est
+  // hors de l'image et passe par la somme directe.
+  std::vector<Particle> particles;
+  std::mt19937 rnd(0);
+  std::uniform_int_distribution<int> pix(1, resol - 2);
+  std::uniform_real_distribution<double> q(-1, 1);
+  for (int c = 0; c < 50; c++) {
+    particles.push_back(Particle({1.0 * pix(rnd) / resol, 1.0 * pix(rnd) / resol}, {0, 0}, q(rnd)));
+  }
+  particles.push_back(Particle({1.2, -0.1}, {0, 0}, 1));
+
+  PotentialSerial serial(resol, resol);
+  PotentialFFT fft(resol, resol, cic);
+  double lo_serial, hi_serial;
+  double lo_fft, hi_fft;
+  serial.compute_field(particles, lo_serial, hi_serial);
+  fft.compute_field(particles, lo_fft, hi_fft);
+
+  double vmax = std::max(std::abs(lo_serial), std::abs(hi_serial));
+  double max_err = 0.0;
+  for (size_t p = 0; p < serial.m_sol.size(); p++) {
+    max_err = std::max(max_err, std::abs(fft.m_sol[p] - serial.m_sol[p]) / vmax);
+  }
+  INFO("cic: " << cic << " max_err: " << max_err);
+  CHECK(max_err < 1e-9);
+  CHECK_THAT(lo_fft, Matchers::WithinAbs(lo_serial, 1e-9 * vmax));
+  CHECK_THAT(hi_fft, Matchers::WithinAbs(hi_serial, 1e-9 * vmax));
+}
+
+TEST_CASE("PotentialParallelNuma") {
+  int resol = 100;
+  int numpart = 50;
+  std::string colormap_name(SOURCE_DIR "/data/colormap_parula.png");
+  ColorMap cmap;
+  cmap.load(colormap_name);
+
+  PotentialSerial serial(resol, resol);
+  PotentialParallel parallel(resol, resol);
+  parallel.set_numa(true);
+
+  std::vector<Particle> particles;
+  experiment_random(numpart, particles);
+  double lo_serial, hi_serial;
+  double lo_parallel, hi_parallel;
+
+  serial.compute_field(particles, lo_serial, hi_serial);
+  parallel.compute_field(particles, lo_parallel, hi_parallel);
+
+  CHECK(std::abs(lo_serial - lo_parallel) < abstol);
+  CHECK(std::abs(hi_serial - hi_parallel) < abstol);
+  CHECK(std::equal(serial.m_sol.begin(), serial.m_sol.end(), parallel.m_sol.begin(), parallel.m_sol.end()));
+
+  cmap.update_scale(lo_serial, hi_serial);
+  std::ostringstream oss_serial, oss_parallel;
+  serial.save_solution(oss_serial, cmap);
+  parallel.save_solution(oss_parallel, cmap);
+  CHECK(oss_serial.str() == oss_parallel.str());
+
+  // seul le moteur tbb suit les bandes de noeud
+  EngineConfig cfg;
+  cfg.width = cfg.height = 16;
+  cfg.numa = true;
+  for (int engine : {ENGINE_TBB, ENGINE_TILED}) {
+    cfg.engine = engine;
+    std::unique_ptr<IPotential> made(make_engine(cfg));
+    CHECK((static_cast<PotentialParallel&>(*made).m_numa != nullptr) == (engine == ENGINE_TBB));
+  }
+}
+
+TEST_CASE("AutotuneCache") {
+  std::filesystem::path cache = std::filesystem::temp_directory_path() / "potential-tuning-test.txt";
+  std::filesystem::remove(cache);
+
+  std::vector<Particle> particles;
+  experiment_random(10, particles);
+  EngineConfig base;
+  base.width = 32;
+  base.height = 32;
+
+  EngineConfig first = autotune(base, particles, 1e-9, 2, cache.string(), false);
+  REQUIRE(std::filesystem::exists(cache));
+  EngineConfig second = autotune(base, particles, 1e-9, 2, cache.string(), false);
+  CHECK(describe(first) == describe(second));
+
+  // une autre signature déclenche un nouvel essai et ajoute une ligne
+  base.width = 16;
+  autotune(base, particles, 1e-9, 2, cache.string(), false);
+  auto lines = [&] {
+    std::ifstream ifs(cache);
+    return std::count(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>(), '\n');
+  };
+  CHECK(lines() == 2);
+
+  // le nombre de fils fait partie de la signature, même limité par
+  // global_control (option -t) dans une arène plus grande
+  base.width = 8;
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  arena.execute([&] {
+    autotune(base, particles, 1e-9, 2, cache.string(), false);
+    auto before = lines();
+    tbb::global_control one(tbb::global_control::max_allowed_parallelism, 1);
+    CHECK(effective_concurrency() == 1);
+    autotune(base, particles, 1e-9, 2, cache.string(), false);
+    CHECK(lines() == before + 1);
+  });
+
+  // avec une portée, le moteur série n'est pas candidat et la signature
+  // change
+  base.cutoff = 0.1;
+  for (const EngineConfig& c : autotune_candidates(base)) {
+    CHECK(c.engine != ENGINE_SERIAL);
+  }
+  auto before = lines();
+  EngineConfig cut = autotune(base, particles, 1e-9, 2, cache.string(), false);
+  CHECK(cut.engine != ENGINE_SERIAL);
+  CHECK(cut.cutoff == 0.1);
+  CHECK(lines() == before + 1);
+  CHECK(describe(autotune(base, particles, 1e-9, 2, cache.string(), false)) == describe(cut));
+  CHECK(lines() == before + 1);
+
+  std::filesystem::remove(cache);
+}
+
+TEST_CASE("PotentialParallelMoveParticlesPaths") {
+  // série (n petit), région parallèle persistante, puis deux parallel_for
+  // par sous-pas (n grand)
+  int numpart = GENERATE(30, 200, 2100);
+  int substeps = numpart > 1000 ? 2 : 10;
+  double dt = 1e-9;
+
+  PotentialSerial serial(16, 16);
+  PotentialParallel parallel(16, 16);
+
+  std::vector<Particle> particles_serial;
+  experiment_random(numpart, particles_serial);
+  std::vector<Particle> particles_parallel(particles_serial);
+
+  serial.move_particles(particles_serial, dt, substeps);
+  // plusieurs fils même sur une machine à un seul coeur
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  arena.execute([&] { parallel.move_particles(particles_parallel, dt, substeps); });
+
+  INFO("numpart: " << numpart);
+  for (size_t i = 0; i < particles_serial.size(); ++i) {
+    REQUIRE(particles_serial[i].m_x == particles_parallel[i].m_x);
+    REQUIRE(particles_serial[i].m_p == particles_parallel[i].m_p);
+    REQUIRE(particles_serial[i].m_v == particles_parallel[i].m_v);
+    REQUIRE(particles_serial[i].m_f == particles_parallel[i].m_f);
+  }
+}
+
+TEST_CASE("CostModelDispatch") {
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  arena.execute([&] {
+    const CostModel& model = CostModel::calibrated();
+    CHECK(model.launch > 0);
+    CHECK(model.pair_cost > 0);
+    CHECK(model.pixel_cost > 0);
+
+    // deux charges: rien à gagner
+    CHECK(model.move(2, 1) == Execution::Serial);
+    CHECK(model.field(4, 4, 2) == Execution::Serial);
+    CHECK(model.save(16) == Execution::Serial);
+
+    // beaucoup de travail: parallèle
+    CHECK(model.move(10000, 10) == Execution::Charges);
+    CHECK(model.field(1024, 1024, 1000) == Execution::Rows);
+    // vignette avec beaucoup de charges: découpage sur les charges
+    CHECK(model.field(8, 8, 200000) == Execution::Charges);
+
+    // un seul fil permis par -t, même dans une arène de 4
+    tbb::global_control one(tbb::global_control::max_allowed_parallelism, 1);
+    CHECK(model.move(10000, 10) == Execution::Serial);
+    CHECK(model.field(1024, 1024, 1000) == Execution::Serial);
+    CHECK(model.field(8, 8, 200000) == Execution::Serial);
+  });
+}
+
+TEST_CASE("PotentialParallelFieldByCharges") {
+  int resol = 8;
+  int numpart = 5000;
+
+  PotentialSerial serial(resol, resol);
+  PotentialParallel parallel(resol, resol);
+
+  std::vector<Particle> particles;
+  experiment_random(numpart, particles);
+  double lo_serial, hi_serial;
+  double lo_parallel, hi_parallel;
+
+  serial.compute_field(particles, lo_serial, hi_serial);
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  arena.execute([&] { parallel.compute_field_by_charges(particles, lo_parallel, hi_parallel); });
+
+  // l'ordre des sommes change: comparaison relative à l'amplitude du champs
+  double vmax = std::max(std::abs(lo_serial), std::abs(hi_serial));
+  CHECK_THAT(lo_parallel, Matchers::WithinAbs(lo_serial, 1e-12 * vmax));
+  CHECK_THAT(hi_parallel, Matchers::WithinAbs(hi_serial, 1e-12 * vmax));
+  for (size_t p = 0; p < serial.m_sol.size(); p++) {
+    REQUIRE_THAT(parallel.m_sol[p], Matchers::WithinAbs(serial.m_sol[p], 1e-12 * vmax));
+  }
+}
+
+TEST_CASE("MoveParticlesDiagnostics") {
+  int numpart = GENERATE(25, 200);
+  double dt = 1e-9;
+
+  std::vector<Particle> initial;
+  experiment_random(numpart, initial);
+  // vitesses non nulles pour l'énergie cinétique
+  for (size_t i = 0; i < initial.size(); i++) {
+    initial[i].m_v = Vector2d(1e3 * i, -2e3 * i);
+  }
+
+  // diagnostics calculés à part sur l'état initial
+  Diagnostics expected;
+  for (size_t i = 0; i < initial.size(); i++) {
+    expected.kinetic += 0.5 * initial[i].m_v.squaredNorm();
+    expected.momentum += initial[i].m_v;
+    for (size_t j = i + 1; j < initial.size(); j++) {
+      double r = (initial[i].m_x - initial[j].m_x).norm() + eps;
+      expected.potential += k * initial[i].m_q * initial[j].m_q / r;
+    }
+  }
+
+  PotentialSerial serial(16, 16);
+  PotentialParallel parallel(16, 16);
+  serial.m_diagnostics = true;
+  parallel.m_diagnostics = true;
+
+  // avec un seul sous-pas, les diagnostics portent sur l'état initial
+  std::vector<Particle> particles_serial(initial);
+  std::vector<Particle> particles_parallel(initial);
+  serial.move_particles(particles_serial, dt, 1);
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  arena.execute([&] { parallel.move_particles(particles_parallel, dt, 1); });
+
+  for (const Diagnostics& d : {serial.m_diag, parallel.m_diag}) {
+    CHECK_THAT(d.kinetic, Matchers::WithinRel(expected.kinetic, 1e-12));
+    CHECK_THAT(d.potential, Matchers::WithinRel(expected.potential, 1e-9));
+    CHECK_THAT((d.momentum - expected.momentum).norm(), Matchers::WithinAbs(0, 1e-9 * expected.momentum.norm()));
+  }
+
+  // le déplacement n'est pas modifié par les diagnostics
+  for (size_t i = 0; i < particles_serial.size(); ++i) {
+    REQUIRE(particles_serial[i].m_x == particles_parallel[i].m_x);
+    REQUIRE(particles_serial[i].m_v == particles_parallel[i].m_v);
+  }
+}
+
+TEST_CASE("PotentialParallelElectricField") {
+  std::vector<Particle> charges;
+  experiment_random(20, charges);
+  int w = 24;
+  int h = 20;
+
+  PotentialSerial serial(w, h);
+  PotentialParallel parallel(w, h);
+  parallel.m_efield = true;
+  double lo1, hi1, lo2, hi2;
+  serial.compute_field(charges, lo1, hi1);
+  parallel.compute_field(charges, lo2, hi2);
+
+  // le potentiel est le même qu'en série, bit à bit
+  REQUIRE(std::equal(serial.m_sol.begin(), serial.m_sol.end(), parallel.m_sol.begin()));
+  REQUIRE(parallel.m_efield_valid);
+
+  // le champs est -grad(V), comparé à une différence centrée
+  double step = 1e-6;
+  auto potential = [&](double x, double y) {
+    double v = 0.0;
+    for (const Particle& c : charges) {
+      v += c.potential_at({x, y});
+    }
+    return v;
+  };
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      double x = 1.0 * j / w;
+      double y = 1.0 * i / h;
+      double ex = -(potential(x + step, y) - potential(x - step, y)) / (2 * step);
+      double ey = -(potential(x, y + step) - potential(x, y - step)) / (2 * step);
+      double scale = std::hypot(ex, ey) + 1.0;
+      CHECK_THAT(parallel.m_ex[IDX2(i, j, w)], Matchers::WithinAbs(ex, 1e-5 * scale));
+      CHECK_THAT(parallel.m_ey[IDX2(i, j, w)], Matchers::WithinAbs(ey, 1e-5 * scale));
+    }
+  }
+
+  // la sauvegarde brute contient les trois composantes
+  std::stringstream ss;
+  parallel.save_raw(ss);
+  int rw, rh;
+  std::vector<std::vector<double>> comps;
+  REQUIRE(read_raw_field(ss, rw, rh, comps));
+  REQUIRE(rw == w);
+  REQUIRE(rh == h);
+  REQUIRE(comps.size() == 3);
+  REQUIRE(std::equal(comps[0].begin(), comps[0].end(), parallel.m_sol.begin()));
+  REQUIRE(std::equal(comps[1].begin(), comps[1].end(), parallel.m_ex.begin()));
+  REQUIRE(std::equal(comps[2].begin(), comps[2].end(), parallel.m_ey.begin()));
+}
+
+TEST_CASE("PotentialParallelVerletList") {
+  std::vector<Particle> initial;
+  experiment_random(300, initial);
+  double dt = 1e-9;
+  int substeps = 20;
+  double cutoff = 0.1;
+
+  // référence: toutes les paires, coupées à la même portée
+  std::vector<Particle> expected(initial);
+  double ssdt = dt / substeps;
+  for (int ss = 0; ss < substeps; ss++) {
+    std::vector<Vector2d> x;
+    for (const Particle& c : expected) {
+      x.push_back(c.m_x);
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+      Vector2d f = Vector2d::Zero();
+      for (size_t j = 0; j < expected.size(); j++) {
+        if (i != j && (x[i] - x[j]).squaredNorm() < cutoff * cutoff) {
+          f += Particle::coulomb_force(x[i], expected[i].m_q, x[j], expected[j].m_q);
+        }
+      }
+      Particle& c = expected[i];
+      c.m_f = f;
+      c.m_v += c.m_f * ssdt;
+      c.m_p = x[i];
+      c.m_x = x[i] + c.m_v * ssdt;
+    }
+  }
+
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  for (double skin : {0.0, 0.02, 0.2}) {
+    PotentialParallel parallel(16, 16);
+    parallel.m_dispatch = false;
+    parallel.m_cutoff = cutoff;
+    parallel.m_skin = skin;
+    std::vector<Particle> particles(initial);
+    arena.execute([&] { parallel.move_particles(particles, dt, substeps); });
+
+    // les voisins sont triés: même ordre de sommation que la référence
+    for (size_t i = 0; i < particles.size(); ++i) {
+      REQUIRE(particles[i].m_x == expected[i].m_x);
+      REQUIRE(particles[i].m_v == expected[i].m_v);
+    }
+    INFO("skin " << skin << " builds " << parallel.m_neighbors.m_builds);
+    if (skin == 0.0) {
+      CHECK(parallel.m_neighbors.m_builds == substeps);
+    } else {
+      CHECK(parallel.m_neighbors.m_builds < substeps);
+    }
+  }
+}
+
+TEST_CASE("MortonReorder") {
+  REQUIRE(morton_code(0, 0) == 0);
+  REQUIRE(morton_code(1, 0) == 1);
+  REQUIRE(morton_code(0, 1) == 2);
+  REQUIRE(morton_code(3, 3) == 15);
+  REQUIRE(morton_code(0xffffffff, 0xffffffff) == ~0ULL);
+
+  std::vector<Particle> initial;
+  experiment_random(5000, initial);
+  std::vector<Particle> particles(initial);
+  std::vector<int> ids;
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+  arena.execute([&] { morton_sort(particles, ids); });
+
+  // chaque particule garde son indice d'origine
+  REQUIRE(ids.size() == initial.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    REQUIRE(particles[i].m_x == initial[ids[i]].m_x);
+    REQUIRE(particles[i].m_q == initial[ids[i]].m_q);
+  }
+
+  // les voisins en mémoire sont proches dans l'espace
+  auto mean_gap = [](const std::vector<Particle>& p) {
+    double sum = 0.0;
+    for (size_t i = 1; i < p.size(); ++i) {
+      sum += (p[i].m_x - p[i - 1].m_x).norm();
+    }
+    return sum / (p.size() - 1);
+  };
+  CHECK(mean_gap(particles) < 0.1 * mean_gap(initial));
+
+  // un deuxième tri compose les permutations
+  particles[0].m_x = {0.9, 0.9};
+  Vector2d moved = particles[0].m_x;
+  int moved_id = ids[0];
+  arena.execute([&] { morton_sort(particles, ids); });
+  restore_order(particles, ids);
+  for (size_t i = 0; i < particles.size(); ++i) {
+    REQUIRE(ids[i] == int(i));
+    REQUIRE(particles[i].m_q == initial[i].m_q);
+    REQUIRE(particles[i].m_x == (int(i) == moved_id ? moved : initial[i].m_x));
+  }
+
+  // run() repart de l'ordre d'origine, même avec moins de particules que
+  // l'appel précédent
+  ColorMap cmap;
+  PotentialSerial sim(8, 8);
+  sim.m_reorder = 1;
+  sim.m_progress = false;
+  for (int n : {200, 50}) {
+    std::vector<Particle> expected;
+    experiment_random(n, expected);
+    std::vector<Particle> sorted(expected);
+    sim.run(sorted, 2, 1e-9, 1, false, cmap, "", false);
+    REQUIRE(sim.m_ids.size() == size_t(n));
+    for (int i = 0; i < n; ++i) {
+      REQUIRE(sorted[i].m_q == expected[i].m_q);
+    }
+  }
+}
+
+TEST_CASE("CounterBasedExperiments") {
+  // vecteurs de référence de Random123 pour Philox4x32-10
+  REQUIRE(Philox4x32::generate({0, 0, 0, 0}, 0) == Philox4x32::Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+  REQUIRE(Philox4x32::generate({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, 0xffffffffffffffffULL) ==
+          Philox4x32::Counter{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+  REQUIRE(Philox4x32::generate({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, 0x299f31d0a4093822ULL) ==
+          Philox4x32::Counter{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+
+  // même résultat avec 1 ou 4 fils
+  int n = 10000;
+  std::vector<Particle> one;
+  std::vector<Particle> four;
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena(1).execute([&] { experiment_random_counter(n, one, 42); });
+  tbb::task_arena(4).execute([&] { experiment_random_counter(n, four, 42); });
+  REQUIRE(one.size() == size_t(n));
+  for (int i = 0; i < n; i++) {
+    REQUIRE(one[i].m_x == four[i].m_x);
+    REQUIRE(one[i].m_q == four[i].m_q);
+    REQUIRE(one[i].m_x.minCoeff() >= 0.2);
+    REQUIRE(one[i].m_x.maxCoeff() < 0.8);
+    REQUIRE(std::abs(one[i].m_q) <= 1.0);
+  }
+
+  // une autre graine donne d'autres particules
+  std::vector<Particle> other;
+  experiment_random_counter(n, other, 43);
+  REQUIRE(other[0].m_x != one[0].m_x);
+
+  // les générateurs déterministes ajoutent à la suite, dans le même ordre
+  std::vector<Particle> crystal;
+  experiment_basic(crystal);
+  tbb::task_arena(4).execute([&] { experiment_crystal(20, crystal); });
+  double step = 0.4 / 19;
+  REQUIRE(crystal.size() == 2 + 3 * 19 + 2 * 4);
+  REQUIRE(crystal[2].m_x == Vector2d(0.3 + step / 2, 0.3));
+  REQUIRE(crystal[2 + 19].m_x == Vector2d(0.3, 0.3 + step));
+  REQUIRE(crystal[2 + 19].m_q == -1);
+  REQUIRE(crystal.back().m_x == Vector2d(0.3 + step / 2 + 18 * step, 0.3 + 4 * step));
+
+  std::vector<Particle> collision;
+  tbb::task_arena(4).execute([&] { experiment_collision(5, collision); });
+  REQUIRE(collision.size() == 10);
+  REQUIRE(collision[6].m_x == Vector2d(0.1 - 3 * 0.125, 0.499));
+  REQUIRE(collision[7].m_x == Vector2d(0.9 + 3 * 0.125, 0.501));
+  REQUIRE(collision[7].m_v == Vector2d(-1e7, 0));
+}
+
+TEST_CASE("ParticleFiles") {
+  std::vector<Particle> initial;
+  experiment_random_counter(100000, initial, 7);
+  initial[3].m_v = {1e7, -2.5};
+  std::filesystem::path dir = std::filesystem::temp_directory_path();
+
+  // écriture par blocs, puis relecture en parallèle
+  std::filesystem::path binary = dir / "potential-test-particles.bin";
+  {
+    std::ofstream ofs(binary, std::ios::binary);
+    ParticleWriter writer(ofs);
+    writer.write(initial[0]);
+    writer.write(std::vector<Particle>(initial.begin() + 1, initial.end()));
+  }
+  REQUIRE(std::filesystem::file_size(binary) == 12 + 40 * initial.size());
+  std::vector<Particle> loaded;
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena(4).execute([&] { load_particles(binary.string(), loaded); });
+  REQUIRE(loaded.size() == initial.size());
+  for (size_t i = 0; i < initial.size(); i++) {
+    REQUIRE(loaded[i].m_x == initial[i].m_x);
+    REQUIRE(loaded[i].m_v == initial[i].m_v);
+    REQUIRE(loaded[i].m_q == initial[i].m_q);
+  }
+
+  // flot sans positionnement (tube): le nombre reste -1 et la lecture va jusqu'à la fin
+  struct PipeBuf : std::streambuf {
+    std::streambuf* m_out;
+    explicit PipeBuf(std::streambuf* out) : m_out(out) {}
+    int_type overflow(int_type c) override {
+      return m_out->sputc(traits_type::to_char_type(c));
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+      return m_out->sputn(s, n);
+    }
+  };
+  {
+    std::ofstream ofs(binary, std::ios::binary);
+    PipeBuf pipe(ofs.rdbuf());
+    std::ostream os(&pipe);
+    ParticleWriter writer(os);
+    writer.write(initial);
+    writer.finish();
+    REQUIRE(os.good());
+  }
+  std::vector<Particle> piped;
+  load_particles(binary.string(), piped);
+  REQUIRE(piped.size() == initial.size());
+  REQUIRE(piped.back().m_x == initial.back().m_x);
+
+  // CSV avec entête
+  std::filesystem::path csv = dir / "potential-test-particles.csv";
+  {
+    std::ofstream ofs(csv);
+    ofs << "x,y,vx,vy,q\n0.25,0.5,0,0,1\r\n\n 0.75, 0.5, 1e3, -2, -1.5\n";
+  }
+  std::vector<Particle> small;
+  load_particles(csv.string(), small);
+  REQUIRE(small.size() == 2);
+  REQUIRE(small[1].m_x == Vector2d(0.75, 0.5));
+  REQUIRE(small[1].m_v == Vector2d(1e3, -2));
+  REQUIRE(small[1].m_q == -1.5);
+
+  // les fichiers invalides sont refusés
+  {
+    std::ofstream ofs(csv);
+    ofs << "0.25,0.5,0,0\n";
+  }
+  REQUIRE_THROWS_AS(load_particles(csv.string(), small), std::runtime_error);
+  std::filesystem::resize_file(binary, 12 + 40 * 10 + 8);
+  REQUIRE_THROWS_AS(load_particles(binary.string(), small), std::runtime_error);
+  {
+    // le nombre complété à la fin est vérifié contre la taille
+    std::ofstream ofs(binary, std::ios::binary);
+    ParticleWriter writer(ofs);
+    writer.write(initial);
+  }
+  std::filesystem::resize_file(binary, 12 + 40 * 10);
+  REQUIRE_THROWS_AS(load_particles(binary.string(), small), std::runtime_error);
+  REQUIRE_THROWS_AS(load_particles((dir / "potential-test-missing.bin").string(), small), std::runtime_error);
+  std::filesystem::remove(binary);
+  std::filesystem::remove(csv);
+}
+
+TEST_CASE("CheckpointRestart") {
+  std::string colormap_name(SOURCE_DIR "/data/colormap_parula.png");
+  std::filesystem::path dir = std::filesystem::temp_directory_path() / "potential-test-checkpoint";
+  std::filesystem::create_directories(dir);
+  std::string outfmt = (dir / "p-{:06d}.png").string();
+  std::string checkpoint = (dir / "state.ckp").string();
+  std::filesystem::remove(checkpoint);
+
+  std::vector<Particle> initial;
+  experiment_random(50, initial);
+  double dt = 1e-9;
+  int substeps = 5;
+
+  // exécution complète de 6 itérations, avec réordonnement
+  std::vector<Particle> expected(initial);
+  ColorMap cmap_full;
+  cmap_full.load(colormap_name);
+  {
+    PotentialParallel full(32, 32);
+    full.m_reorder = 2;
+    full.run(expected, 6, dt, substeps, true, cmap_full, outfmt, false);
+  }
+
+  // exécution interrompue après 4 itérations, puis reprise jusqu'à 6
+  std::vector<Particle> particles(initial);
+  {
+    ColorMap cmap;
+    cmap.load(colormap_name);
+    PotentialParallel first(32, 32);
+    first.m_reorder = 2;
+    first.m_checkpoint = checkpoint;
+    first.m_checkpoint_every = 2;
+    first.run(particles, 4, dt, substeps, true, cmap, outfmt, false);
+  }
+  Checkpoint cp;
+  REQUIRE(read_checkpoint(checkpoint, cp));
+  REQUIRE(cp.iter == 4);
+  REQUIRE(cp.ids.size() == initial.size());
+  REQUIRE_FALSE(std::filesystem::exists(checkpoint + ".tmp"));
+
+  std::vector<Particle> resumed(initial);
+  ColorMap cmap;
+  cmap.load(colormap_name);
+  PotentialParallel second(32, 32);
+  second.m_reorder = 2;
+  second.m_checkpoint = checkpoint;
+  second.m_restart = true;
+  second.run(resumed, 6, dt, substeps, true, cmap, outfmt, false);
+
+  // identique bit à bit, dans l'ordre d'origine
+  REQUIRE(resumed.size() == expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    REQUIRE(resumed[i].m_x == expected[i].m_x);
+    REQUIRE(resumed[i].m_v == expected[i].m_v);
+    REQUIRE(resumed[i].m_q == expected[i].m_q);
+  }
+  REQUIRE(cmap.m_lo == cmap_full.m_lo);
+  REQUIRE(cmap.m_hi == cmap_full.m_hi);
+
+  // un point de reprise tronqué est refusé sans toucher à l'état lu
+  std::filesystem::resize_file(checkpoint, std::filesystem::file_size(checkpoint) - 4);
+  REQUIRE_FALSE(read_checkpoint(checkpoint, cp));
+  REQUIRE(cp.iter == 4);
+  REQUIRE(cp.particles.size() == initial.size());
+  REQUIRE(cp.ids.size() == initial.size());
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("EnsembleRunner") {
+  std::string colormap_name(SOURCE_DIR "/data/colormap_parula.png");
+  ColorMap cmap;
+  cmap.load(colormap_name);
+
+  Job base;
+  base.engine.width = 16;
+  base.engine.height = 16;
+  base.max_iter = 3;
+  base.substeps = 4;
+  std::istringstream file(
+      "# balayage\n"
+      "name=a e=4 seed=1 n=30 p=1\n"
+      "\n"
+      "name=b e=4 seed=2 n=30 p=0 dt=2e-9\n"
+      "e=3 p=3 r=8 s=2\n");
+  std::vector<Job> jobs = parse_jobs(file, base);
+  REQUIRE(jobs.size() == 3);
+  REQUIRE(jobs[1].name == "b");
+  REQUIRE(jobs[1].dt == 2e-9);
+  REQUIRE(jobs[1].max_iter == 3);
+  REQUIRE(jobs[2].name == "job2");
+  REQUIRE(jobs[2].engine.width == 8);
+
+  std::istringstream bad("name=x foo=1\n");
+  REQUIRE_THROWS_AS(parse_jobs(bad, base), std::runtime_error);
+  std::istringstream bad_value("n=abc\n");
+  REQUIRE_THROWS_AS(parse_jobs(bad_value, base), std::runtime_error);
+  // la graine change l'expérience aléatoire, mais pas le cristal
+  std::istringstream seeds("e=0 seed=1 n=5\ne=0 seed=2 n=5\n");
+  std::vector<Job> random = parse_jobs(seeds, base);
+  std::vector<Particle> first, second;
+  make_experiment(random[0].experiment, random[0].numpart, random[0].seed, first);
+  make_experiment(random[1].experiment, random[1].numpart, random[1].seed, second);
+  CHECK(first[0].m_x != second[0].m_x);
+  std::istringstream bad_seed("seed=1 e=1 n=5\n");
+  REQUIRE_THROWS_AS(parse_jobs(bad_seed, base), std::runtime_error);
+  std::istringstream bad_engine("p=6\n");
+  REQUIRE_THROWS_AS(parse_jobs(bad_engine, base), std::runtime_error);
+  EngineConfig unknown;
+  unknown.engine = 6;
+  REQUIRE_THROWS_AS(make_engine(unknown), std::runtime_error);
+
+  // chaque simulation donne le même résultat que seule
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  std::vector<std::vector<Particle>> results;
+  tbb::task_arena(4).execute([&] { results = run_ensemble(jobs, cmap, false); });
+  REQUIRE(results.size() == jobs.size());
+  for (size_t j = 0; j < jobs.size(); j++) {
+    const Job& job = jobs[j];
+    std::vector<Particle> particles;
+    make_experiment(job.experiment, job.numpart, job.seed, particles);
+    ColorMap job_cmap = cmap;
+    std::unique_ptr<IPotential> alone(make_engine(job.engine));
+    alone->m_progress = false;
+    alone->run(particles, job.max_iter, job.dt, job.substeps, job.update_scale, job_cmap, "", false);
+    REQUIRE(results[j].size() == particles.size());
+    for (size_t i = 0; i < particles.size(); i++) {
+      REQUIRE(results[j][i].m_x == particles[i].m_x);
+      REQUIRE(results[j][i].m_v == particles[i].m_v);
+    }
+  }
+}
+
+TEST_CASE("ReplicaBatch") {
+  int n = GENERATE(2, 25);
+  int replicas = 11;  // la dernière voie de répliques est incomplète
+  double dt = 1e-9;
+  int substeps = 10;
+
+  std::vector<std::vector<Particle>> initial(replicas);
+  ReplicaBatch batch(n, replicas);
+  for (int r = 0; r < replicas; r++) {
+    if (n == 2) {
+      // deux charges, à une distance différente pour chaque réplique
+      initial[r] = {Particle({0.5 - 0.01 * (r + 1), 0.5}, {0, 0}, 1), Particle({0.5 + 0.01, 0.5}, {0, 0}, -1)};
+    } else {
+      experiment_random_counter(n, initial[r], r);
+    }
+    batch.load(r, initial[r]);
+  }
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena(4).execute([&] {
+    for (int iter = 0; iter < 3; iter++) {
+      batch.move_particles(dt, substeps);
+    }
+  });
+
+  // chaque voie suit exactement le moteur série sur sa réplique
+  for (int r = 0; r < replicas; r++) {
+    std::vector<Particle> expected(initial[r]);
+    PotentialSerial serial(4, 4);
+    for (int iter = 0; iter < 3; iter++) {
+      serial.move_particles(expected, dt, substeps);
+    }
+    std::vector<Particle> particles;
+    batch.store(r, particles);
+    REQUIRE(particles.size() == expected.size());
+    for (int i = 0; i < n; i++) {
+      CHECK_THAT((particles[i].m_x - expected[i].m_x).norm(), Matchers::WithinAbs(0, 1e-12));
+      CHECK_THAT((particles[i].m_v - expected[i].m_v).norm(),
+                 Matchers::WithinAbs(0, 1e-12 * (1 + expected[i].m_v.norm())));
+      CHECK(particles[i].m_p == expected[i].m_p);
+      CHECK(particles[i].m_q == expected[i].m_q);
+    }
+  }
+}
+
+TEST_CASE("PararealIntegration") {
+  std::vector<Particle> initial;
+  experiment_random_counter(12, initial, 5);
+  double dt = 1e-9;
+  int slices = 16;
+
+  // référence: le moteur série, tranche par tranche
+  std::vector<std::vector<Particle>> expected{initial};
+  PotentialSerial serial(1, 1);
+  for (int n = 0; n < slices; n++) {
+    expected.push_back(expected.back());
+    serial.move_particles(expected.back(), dt, 10);
+  }
+
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+
+  SECTION("Exact") {
+    // sans arrêt anticipé, les tranches sont toutes exactes à la fin
+    PararealOptions opt;
+    opt.tol = -1.0;
+    std::vector<std::vector<Particle>> states{initial};
+    int k = 0;
+    arena.execute([&] { k = parareal(states, slices, dt, opt); });
+    REQUIRE(k == slices);
+    for (int n = 0; n <= slices; n++) {
+      for (size_t i = 0; i < initial.size(); i++) {
+        REQUIRE(states[n][i].m_x == expected[n][i].m_x);
+        REQUIRE(states[n][i].m_v == expected[n][i].m_v);
+      }
+    }
+  }
+
+  SECTION("Tolerance") {
+    PararealOptions opt;
+    opt.coarse_substeps = 2;
+    opt.tol = 1e-10;
+    std::vector<std::vector<Particle>> states{initial};
+    int k = 0;
+    arena.execute([&] { k = parareal(states, slices, dt, opt); });
+    INFO("iterations " << k);
+    CHECK(k < slices);
+    for (size_t i = 0; i < initial.size(); i++) {
+      CHECK_THAT((states[slices][i].m_x - expected[slices][i].m_x).norm(), Matchers::WithinAbs(0, 1e-8));
+    }
+  }
+}
+
+// Somme d'Ewald directe, mêmes alpha et rayon de coupure que le solveur:
+// espace réel à l'image la plus proche, tous les modes de Fourier utiles
+static void ewald_reference(const EwaldPME& ewald, const std::vector<Vector2d>& x, const std::vector<double>& q,
+                            const Vector2d& loc, int self, double& phi, Vector2d& f) {
+  double alpha = ewald.m_alpha;
+  int modes = int(std::ceil(2.0 * alpha));
+  phi = 0.0;
+  f = Vector2d::Zero();
+  double total = 0.0;
+  for (size_t j = 0; j < x.size(); j++) {
+    total += q[j];
+    if (int(j) == self) {
+      continue;
+    }
+    Vector2d d = loc - x[j];
+    d(0) -= std::round(d(0));
+    d(1) -= std::round(d(1));
+    double r = d.norm();
+    if (r < ewald.m_cutoff && r > 0) {
+      double rs = r + eps;
+      phi += q[j] * std::erfc(alpha * r) / rs;
+      double dpsi = 2.0 / std::sqrt(M_PI) * alpha * std::exp(-alpha * alpha * r * r) / rs + std::erfc(alpha * r) / (rs * rs);
+      f += q[j] * dpsi / r * d;
+    }
+  }
+  for (int mi = -modes; mi <= modes; mi++) {
+    for (int mj = -modes; mj <= modes; mj++) {
+      if (mi == 0 && mj == 0) {
+        continue;
+      }
+      Vector2d g(2.0 * M_PI * mi, 2.0 * M_PI * mj);
+      double c = 2.0 * M_PI * std::erfc(g.norm() / (2.0 * alpha)) / g.norm();
+      for (size_t j = 0; j < x.size(); j++) {
+        double angle = g.dot(loc - x[j]);
+        phi += c * q[j] * std::cos(angle);
+        f += c * q[j] * std::sin(angle) * g;
+      }
+    }
+  }
+  if (self >= 0) {
+    phi -= q[self] * 2.0 * alpha / std::sqrt(M_PI);
+  }
+  phi += -2.0 * std::sqrt(M_PI) * total / alpha;
+  phi *= k;
+  f *= k;
+}
+
+TEST_CASE("EwaldPME") {
+  std::vector<Particle> particles;
+  experiment_random_counter(30, particles, 3);
+  int n = particles.size();
+  std::vector<Vector2d> x(n);
+  std::vector<double> q(n);
+  for (int i = 0; i < n; i++) {
+    x[i] = particles[i].m_x;
+    q[i] = particles[i].m_q;
+  }
+
+  SECTION("Reference") {
+    for (double accuracy : {1e-3, 1e-5}) {
+      EwaldPME ewald(n, accuracy);
+      ewald.update(x, q);
+      // échelle: potentiel et force typiques entre deux charges voisines
+      double scale_phi = 0.0;
+      double scale_f = 0.0;
+      std::vector<double> phi_ref(n);
+      std::vector<Vector2d> f_ref(n);
+      for (int i = 0; i < n; i++) {
+        ewald_reference(ewald, x, q, x[i], i, phi_ref[i], f_ref[i]);
+        f_ref[i] *= q[i];
+        scale_phi = std::max(scale_phi, std::abs(phi_ref[i]));
+        scale_f = std::max(scale_f, f_ref[i].norm());
+      }
+      INFO("accuracy " << accuracy << " mesh " << ewald.m_mesh << " alpha " << ewald.m_alpha);
+      for (int i = 0; i < n; i++) {
+        double phi;
+        Vector2d f = ewald.force(i, phi);
+        CHECK_THAT(phi, Matchers::WithinAbs(phi_ref[i], 2 * accuracy * scale_phi));
+        CHECK_THAT((f - f_ref[i]).norm(), Matchers::WithinAbs(0, 2 * accuracy * scale_f));
+      }
+      // potentiel en dehors des charges, sans exclusion
+      for (Vector2d loc : {Vector2d(0.1, 0.2), Vector2d(0.77, 0.5), Vector2d(0.0, 0.99)}) {
+        double phi;
+        Vector2d f;
+        ewald_reference(ewald, x, q, loc, -1, phi, f);
+        CHECK_THAT(ewald.potential_at(loc), Matchers::WithinAbs(phi, 2 * accuracy * scale_phi));
+      }
+    }
+  }
+
+  SECTION("Periodic") {
+    // translation d'un nombre entier de périodes, puis d'une fraction
+    EwaldPME ewald(n, 1e-4);
+    ewald.update(x, q);
+    std::vector<Vector2d> shifted(x);
+    for (Vector2d& v : shifted) {
+      v += Vector2d(3.0, -2.0);
+    }
+    EwaldPME other(n, 1e-4);
+    other.update(shifted, q);
+    for (int i = 0; i < n; i++) {
+      double a, b;
+      Vector2d fa = ewald.force(i, a);
+      Vector2d fb = other.force(i, b);
+      CHECK_THAT(b, Matchers::WithinRel(a, 1e-9));
+      CHECK_THAT((fa - fb).norm(), Matchers::WithinAbs(0, 1e-9 * fa.norm()));
+    }
+  }
+
+  SECTION("Engine") {
+    tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+    tbb::task_arena arena(4);
+    PotentialParallel engine(32, 32);
+    engine.m_periodic = true;
+    std::vector<Particle> p(particles);
+    // une particule sort du carré dès le premier pas
+    p[0].m_x = {0.999, 0.5};
+    p[0].m_v = {1e6, 0.0};
+    arena.execute([&] { engine.move_particles(p, 1e-8, 4); });
+    for (const Particle& c : p) {
+      CHECK(c.m_x(0) >= 0.0);
+      CHECK(c.m_x(0) < 1.0);
+      CHECK(c.m_x(1) >= 0.0);
+      CHECK(c.m_x(1) < 1.0);
+    }
+    CHECK(p[0].m_x(0) < 0.5);
+
+    // même pas en série
+    std::vector<Particle> s(particles);
+    s[0].m_x = {0.999, 0.5};
+    s[0].m_v = {1e6, 0.0};
+    PotentialParallel serial(32, 32);
+    serial.m_periodic = true;
+    serial.m_dispatch = false;
+    serial.move_particles(s, 1e-8, 4);
+    for (int i = 0; i < n; i++) {
+      CHECK_THAT((p[i].m_x - s[i].m_x).norm(), Matchers::WithinAbs(0, 1e-12));
+    }
+
+    double lo, hi;
+    arena.execute([&] { engine.compute_field(p, lo, hi); });
+    CHECK(lo < hi);
+    // le potentiel d'un bord est celui du bord opposé
+    std::vector<Vector2d> moved(n);
+    for (int i = 0; i < n; i++) {
+      moved[i] = p[i].m_x;
+    }
+    EwaldPME ewald(n, engine.m_ewald_accuracy);
+    ewald.update(moved, q);
+    for (int i = 0; i < 32; i++) {
+      CHECK_THAT(engine.m_sol[IDX2(i, 0, 32)], Matchers::WithinRel(ewald.potential_at({1.0, i / 32.0}), 1e-9));
+    }
+  }
+}
+
+// Décodeur QOI minimal (https://qoiformat.org), pour vérifier l'encodeur
+static bool decode_qoi(const std::string& data, png::image<png::rgb_pixel>& img) {
+  auto u8 = [&](size_t p) { return std::uint8_t(data[p]); };
+  auto u32 = [&](size_t p) { return u8(p) << 24 | u8(p + 1) << 16 | u8(p + 2) << 8 | u8(p + 3); };
+  std::string end("\0\0\0\0\0\0\0\1", 8);
+  if (data.size() < 22 || data.compare(0, 4, "qoif") != 0 || data.compare(data.size() - 8, 8, end) != 0) {
+    return false;
+  }
+  int w = u32(4);
+  int h = u32(8);
+  img.resize(w, h);
+  std::uint8_t index[64][4] = {};
+  std::uint8_t px[4] = {0, 0, 0, 255};
+  size_t p = 14;
+  int run = 0;
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      if (run > 0) {
+        run--;
+      } else {
+        int b = u8(p++);
+        if (b == 0xfe) {
+          px[0] = u8(p);
+          px[1] = u8(p + 1);
+          px[2] = u8(p + 2);
+          p += 3;
+        } else if ((b & 0xc0) == 0x00) {
+          std::copy(index[b], index[b] + 4, px);
+        } else if ((b & 0xc0) == 0x40) {
+          px[0] += ((b >> 4) & 3) - 2;
+          px[1] += ((b >> 2) & 3) - 2;
+          px[2] += (b & 3) - 2;
+        } else if ((b & 0xc0) == 0x80) {
+          int b2 = u8(p++);
+          int dg = (b & 0x3f) - 32;
+          px[0] += dg - 8 + ((b2 >> 4) & 0x0f);
+          px[1] += dg;
+          px[2] += dg - 8 + (b2 & 0x0f);
+        } else {
+          run = b & 0x3f;
+        }
+        int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        std::copy(px, px + 4, index[hash]);
+      }
+      img.set_pixel(j, i, png::rgb_pixel(px[0], px[1], px[2]));
+    }
+  }
+  return p == data.size() - 8;
+}
+
+TEST_CASE("ImageFormats") {
+  CHECK(image_format("results/potential-{:06d}.png") == ImageFormat::PNG);
+  CHECK(image_format("results/potential-{:06d}.ppm") == ImageFormat::PPM);
+  CHECK(image_format("potential-{:06d}.qoi") == ImageFormat::QOI);
+  CHECK(image_format("potential") == ImageFormat::PNG);
+
+  // une vraie image du potentiel (grands aplats, dégradés) et du bruit
+  ColorMap cmap;
+  cmap.load(SOURCE_DIR "/data/colormap_parula.png");
+  std::vector<Particle> particles;
+  experiment_random_counter(10, particles, 1);
+  PotentialParallel engine(67, 45);
+  double lo, hi;
+  engine.compute_field(particles, lo, hi);
+  cmap.update_scale(lo, hi);
+  std::ostringstream neant;
+  engine.m_image.format = ImageFormat::PPM;
+  engine.save_solution(neant, cmap);
+  png::image<png::rgb_pixel> noise(33, 17);
+  std::mt19937 gen(7);
+  for (int i = 0; i < 17; i++) {
+    for (int j = 0; j < 33; j++) {
+      // petites et grandes différences, et des répétitions
+      int base = j < 10 ? 100 : gen() % 256;
+      noise.set_pixel(j, i, png::rgb_pixel(base, base + gen() % 3, gen() % 2 ? base : gen() % 256));
+    }
+  }
+
+  auto same = [](const png::image<png::rgb_pixel>& a, const png::image<png::rgb_pixel>& b) {
+    REQUIRE(a.get_width() == b.get_width());
+    REQUIRE(a.get_height() == b.get_height());
+    for (size_t i = 0; i < a.get_height(); i++) {
+      for (size_t j = 0; j < a.get_width(); j++) {
+        REQUIRE(a.get_pixel(j, i).red == b.get_pixel(j, i).red);
+        REQUIRE(a.get_pixel(j, i).green == b.get_pixel(j, i).green);
+        REQUIRE(a.get_pixel(j, i).blue == b.get_pixel(j, i).blue);
+      }
+    }
+  };
+  const std::vector<const png::image<png::rgb_pixel>*> images = {&engine.m_img, &noise};
+
+  SECTION("PPM") {
+    for (const png::image<png::rgb_pixel>* img : images) {
+      int w = img->get_width();
+      int h = img->get_height();
+      std::ostringstream oss;
+      write_ppm(oss, *img);
+      std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+      std::string data = oss.str();
+      REQUIRE(data.size() == header.size() + 3 * w * h);
+      CHECK(data.compare(0, header.size(), header) == 0);
+      png::image<png::rgb_pixel> back(w, h);
+      for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+          const char* p = data.data() + header.size() + 3 * IDX2(i, j, w);
+          back.set_pixel(j, i, png::rgb_pixel(p[0], p[1], p[2]));
+        }
+      }
+      same(*img, back);
+    }
+  }
+
+  SECTION("QOI") {
+    for (const png::image<png::rgb_pixel>* img : images) {
+      std::ostringstream oss;
+      write_qoi(oss, *img);
+      png::image<png::rgb_pixel> back;
+      REQUIRE(decode_qoi(oss.str(), back));
+      same(*img, back);
+    }
+    // les aplats de l'image du potentiel se compressent
+    std::ostringstream oss;
+    write_qoi(oss, engine.m_img);
+    CHECK(oss.str().size() < 3 * 67 * 45);
+  }
+
+  SECTION("PNG") {
+    for (const png::image<png::rgb_pixel>* img : images) {
+      for (int level : {-1, 0, 1, 9}) {
+        for (int filter : {-1, 0, 4, 5}) {
+          std::stringstream ss;
+          write_png(ss, *img, level, filter);
+          png::image<png::rgb_pixel> back;
+          back.read_stream(ss);
+          same(*img, back);
+        }
+      }
+    }
+  }
+
+  SECTION("Run") {
+    // le format suit l'extension du gabarit
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "potential-imageio";
+    std::filesystem::create_directories(dir);
+    std::string outfmt = (dir / "frame-{:02d}.qoi").string();
+    PotentialSerial serial(16, 16);
+    serial.m_progress = false;
+    std::vector<Particle> p(particles);
+    serial.run(p, 1, 1e-9, 1, false, cmap, outfmt, false);
+    std::ifstream ifs(dir / "frame-01.qoi", std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    png::image<png::rgb_pixel> back;
+    CHECK(decode_qoi(data, back));
+    CHECK(back.get_width() == 16);
+    std::filesystem::remove_all(dir);
+  }
+}
+
+TEST_CASE("StreamPath") {
+  CHECK(stream_path("-", 41) == "/dev/stdout");
+  CHECK(stream_path("results/film.y4m", 0) == "results/film.y4m");
+  CHECK(stream_path("results/film.apng", 41) == "results/film-000041.apng");
+}
+
+TEST_CASE("Y4MStream") {
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+
+  // dimensions impaires: la dernière colonne et la dernière ligne de
+  // chrominance ne couvrent qu'un pixel sur deux
+  int w = 37;
+  int h = 23;
+  png::image<png::rgb_pixel> img(w, h);
+  std::mt19937 gen(3);
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      img.set_pixel(j, i, png::rgb_pixel(gen() % 256, gen() % 256, gen() % 256));
+    }
+  }
+  img.set_pixel(0, 0, png::rgb_pixel(255, 255, 255));
+  img.set_pixel(1, 0, png::rgb_pixel(0, 0, 0));
+
+  int cw = (w + 1) / 2;
+  int ch = (h + 1) / 2;
+  std::vector<std::uint8_t> y(w * h), u(cw * ch), v(cw * ch);
+  arena.execute([&] { rgb_to_yuv420(img, y.data(), u.data(), v.data()); });
+
+  // BT.601, plage limitée
+  CHECK(y[0] == 235);
+  CHECK(y[1] == 16);
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      png::rgb_pixel p = img.get_pixel(j, i);
+      double ref = 16 + (65.738 * p.red + 129.057 * p.green + 25.064 * p.blue) / 256;
+      REQUIRE(std::abs(y[IDX2(i, j, w)] - ref) <= 1.0);
+    }
+  }
+  for (int ci = 0; ci < ch; ci++) {
+    for (int cj = 0; cj < cw; cj++) {
+      // moyenne du bloc 2x2, bords répétés
+      double r = 0, g = 0, b = 0;
+      for (int di = 0; di < 2; di++) {
+        for (int dj = 0; dj < 2; dj++) {
+          png::rgb_pixel p = img.get_pixel(std::min(2 * cj + dj, w - 1), std::min(2 * ci + di, h - 1));
+          r += p.red / 4.0;
+          g += p.green / 4.0;
+          b += p.blue / 4.0;
+        }
+      }
+      double uref = 128 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256;
+      double vref = 128 + (112.439 * r - 94.154 * g - 18.285 * b) / 256;
+      REQUIRE(std::abs(u[IDX2(ci, cj, cw)] - uref) <= 1.0);
+      REQUIRE(std::abs(v[IDX2(ci, cj, cw)] - vref) <= 1.0);
+    }
+  }
+
+  SECTION("Frames") {
+    std::ostringstream oss;
+    write_y4m(oss, img, 30, true);
+    write_y4m(oss, img, 30, false);
+    std::string header = "YUV4MPEG2 W37 H23 F30:1 Ip A1:1 C420jpeg\n";
+    std::string frame = "FRAME\n" + std::string(y.begin(), y.end()) + std::string(u.begin(), u.end()) +
+                        std::string(v.begin(), v.end());
+    CHECK(oss.str() == header + frame + frame);
+  }
+
+  SECTION("Run") {
+    // un seul flux pour toute la simulation
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "potential-stream.y4m";
+    ColorMap cmap;
+    cmap.load(SOURCE_DIR "/data/colormap_parula.png");
+    std::vector<Particle> particles;
+    experiment_random_counter(5, particles, 2);
+    PotentialParallel engine(20, 10);
+    engine.m_progress = false;
+    arena.execute([&] { engine.run(particles, 3, 1e-9, 1, false, cmap, path.string(), false); });
+    std::ifstream ifs(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::string header = "YUV4MPEG2 W20 H10 F25:1 Ip A1:1 C420jpeg\n";
+    REQUIRE(data.size() == header.size() + 4 * (6 + 20 * 10 + 2 * 10 * 5));
+    CHECK(data.compare(0, header.size(), header) == 0);
+    for (int f = 0; f < 4; f++) {
+      CHECK(data.compare(header.size() + f * (6 + 300), 6, "FRAME\n") == 0);
+    }
+    std::filesystem::remove(path);
+  }
+}
+
+// Chunks d'un APNG: type et données, CRC vérifié
+static std::vector<std::pair<std::string, std::string>> png_chunks(const std::string& data) {
+  std::vector<std::pair<std::string, std::string>> chunks;
+  REQUIRE(data.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0);
+  auto u32 = [&](size_t p) {
+    return uint32_t(std::uint8_t(data[p])) << 24 | uint32_t(std::uint8_t(data[p + 1])) << 16 |
+           uint32_t(std::uint8_t(data[p + 2])) << 8 | uint32_t(std::uint8_t(data[p + 3]));
+  };
+  size_t p = 8;
+  while (p < data.size()) {
+    uint32_t length = u32(p);
+    std::string type = data.substr(p + 4, 4);
+    std::string body = data.substr(p + 8, length);
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(data.data() + p + 4), length + 4);
+    REQUIRE(crc == u32(p + 8 + length));
+    chunks.emplace_back(type, body);
+    p += 12 + length;
+  }
+  return chunks;
+}
+
+static uint32_t be32(const std::string& s, size_t p) {
+  return uint32_t(std::uint8_t(s[p])) << 24 | uint32_t(std::uint8_t(s[p + 1])) << 16 |
+         uint32_t(std::uint8_t(s[p + 2])) << 8 | uint32_t(std::uint8_t(s[p + 3]));
+}
+
+// Décompresser et défiltrer un rectangle RGBA w x h, puis le composer sur
+// canvas (les pixels transparents laissent le canevas intact)
+static void apng_paste(const std::string& zdata, int x0, int y0, int w, int h, png::image<png::rgb_pixel>& canvas) {
+  int n = 4 * w;
+  std::vector<std::uint8_t> raw(h * (n + 1));
+  uLongf size = raw.size();
+  REQUIRE(uncompress(raw.data(), &size, reinterpret_cast<const Bytef*>(zdata.data()), zdata.size()) == Z_OK);
+  REQUIRE(size == raw.size());
+  std::vector<std::uint8_t> prev(n, 0), cur(n);
+  for (int i = 0; i < h; i++) {
+    const std::uint8_t* f = raw.data() + i * (n + 1);
+    for (int k = 0; k < n; k++) {
+      int a = k >= 4 ? cur[k - 4] : 0;
+      int b = prev[k];
+      int c = k >= 4 ? prev[k - 4] : 0;
+      int pred = 0;
+      if (f[0] == 1) {
+        pred = a;
+      } else if (f[0] == 2) {
+        pred = b;
+      } else if (f[0] == 3) {
+        pred = (a + b) / 2;
+      } else if (f[0] == 4) {
+        int q = a + b - c;
+        int pa = std::abs(q - a), pb = std::abs(q - b), pc = std::abs(q - c);
+        pred = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+      }
+      cur[k] = f[1 + k] + pred;
+    }
+    for (int j = 0; j < w; j++) {
+      REQUIRE((cur[4 * j + 3] == 0 || cur[4 * j + 3] == 255));
+      if (cur[4 * j + 3] == 255) {
+        canvas.set_pixel(x0 + j, y0 + i, png::rgb_pixel(cur[4 * j], cur[4 * j + 1], cur[4 * j + 2]));
+      }
+    }
+    prev = cur;
+  }
+}
+
+TEST_CASE("ApngStream") {
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+
+  ColorMap cmap;
+  cmap.load(SOURCE_DIR "/data/colormap_parula.png");
+  std::vector<Particle> particles;
+  experiment_random_counter(6, particles, 4);
+  PotentialParallel engine(64, 48);
+  double lo, hi;
+  engine.compute_field(particles, lo, hi);
+  cmap.update_scale(lo, hi);
+  std::ostringstream neant;
+  engine.save_solution(neant, cmap);
+
+  // trois images: la base, un bloc modifié, la même encore
+  std::vector<png::image<png::rgb_pixel>> frames(3, engine.m_img);
+  for (int i = 10; i < 14; i++) {
+    for (int j = 20; j < 31; j++) {
+      frames[1].set_pixel(j, i, png::rgb_pixel(i, j, 7));
+    }
+  }
+  frames[2] = frames[1];
+
+  SECTION("ChangedRect") {
+    Rect r;
+    arena.execute([&] { r = changed_rect(frames[0], frames[1]); });
+    CHECK(r.x0 == 20);
+    CHECK(r.x1 == 31);
+    CHECK(r.y0 == 10);
+    CHECK(r.y1 == 14);
+    arena.execute([&] { r = changed_rect(frames[1], frames[2]); });
+    CHECK(r.empty());
+  }
+
+  SECTION("Frames") {
+    for (int filter : {-1, 0, 1, 2, 3, 4}) {
+      ImageOptions opt;
+      opt.format = ImageFormat::APNG;
+      opt.png_filter = filter;
+      std::stringstream ss;
+      arena.execute([&] {
+        FrameStream stream(ss, opt, frames.size());
+        for (const auto& f : frames) {
+          stream.write(f);
+        }
+        stream.finish();
+      });
+      std::string data = ss.str();
+
+      // l'image par défaut se lit comme un PNG ordinaire
+      png::image<png::rgb_pixel> first;
+      std::istringstream iss(data);
+      first.read_stream(iss);
+      CHECK(changed_rect(first, frames[0]).empty());
+
+      auto chunks = png_chunks(data);
+      REQUIRE(chunks.front().first == "IHDR");
+      REQUIRE(chunks[1].first == "acTL");
+      CHECK(be32(chunks[1].second, 0) == frames.size());
+      CHECK(chunks.back().first == "IEND");
+
+      png::image<png::rgb_pixel> canvas(64, 48);
+      uint32_t sequence = 0;
+      int frame = -1;
+      std::vector<Rect> rects;
+      std::string zdata;
+      auto flush = [&] {
+        if (frame >= 0) {
+          const Rect& r = rects.back();
+          apng_paste(zdata, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, canvas);
+          CHECK(changed_rect(canvas, frames[frame]).empty());
+        }
+      };
+      for (const auto& [type, body] : chunks) {
+        if (type == "fcTL") {
+          flush();
+          frame++;
+          zdata.clear();
+          CHECK(be32(body, 0) == sequence++);
+          int w = be32(body, 4), h = be32(body, 8), x = be32(body, 12), y = be32(body, 16);
+          rects.push_back(Rect{x, y, x + w, y + h});
+          CHECK(body[24] == 0);                     // dispose NONE
+          CHECK(body[25] == (frame == 0 ? 0 : 1));  // blend SOURCE, puis OVER
+        } else if (type == "IDAT") {
+          zdata += body;
+        } else if (type == "fdAT") {
+          CHECK(be32(body, 0) == sequence++);
+          zdata += body.substr(4);
+        }
+      }
+      flush();
+      REQUIRE(frame == 2);
+      CHECK(rects[0].x1 == 64);
+      CHECK(rects[0].y1 == 48);
+      // seul le bloc modifié, puis un seul pixel pour l'image identique
+      CHECK(rects[1].x0 == 20);
+      CHECK(rects[1].y0 == 10);
+      CHECK(rects[1].x1 == 31);
+      CHECK(rects[1].y1 == 14);
+      CHECK(rects[2].x1 - rects[2].x0 == 1);
+      CHECK(rects[2].y1 - rects[2].y0 == 1);
+    }
+  }
+}
+
+TEST_CASE("FieldStore") {
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, 4);
+  tbb::task_arena arena(4);
+
+  std::vector<Particle> charges;
+  experiment_random(20, charges);
+  int w = 50;
+  int h = 40;
+  PotentialParallel engine(w, h);
+  engine.m_efield = true;
+
+  // 7 itérations, petits blocs: plusieurs blocs par composante, le dernier
+  // incomplet
+  FieldStoreOptions opt;
+  opt.block = 300;
+  opt.keyframe = 3;
+  std::vector<std::vector<std::vector<double>>> frames;
+  std::stringstream lossless;
+  std::stringstream lossy;
+  std::stringstream raw;
+  FieldStore store(lossless, opt, 10);
+  opt.mantissa_bits = 20;
+  FieldStore rounded(lossy, opt, 10);
+  arena.execute([&] {
+    for (int f = 0; f < 7; f++) {
+      double lo, hi;
+      engine.compute_field(charges, lo, hi);
+      std::vector<const double*> components = {engine.m_sol.data(), engine.m_ex.data(), engine.m_ey.data()};
+      frames.emplace_back();
+      for (const double* c : components) {
+        frames.back().emplace_back(c, c + w * h);
+      }
+      store.write(w, h, components);
+      rounded.write(w, h, components);
+      write_raw_field(raw, w, h, components);
+      engine.move_particles(charges, 1e-9, 5);
+    }
+  });
+  store.finish();
+  rounded.finish();
+  CHECK(lossless.str().size() < raw.str().size());
+  CHECK(lossy.str().size() < lossless.str().size());
+
+  SECTION("Lossless") {
+    FieldStoreReader reader;
+    REQUIRE(reader.open(lossless));
+    REQUIRE(reader.frames() == 7);
+    REQUIRE(reader.m_width == w);
+    REQUIRE(reader.m_height == h);
+    REQUIRE(reader.m_components == 3);
+    REQUIRE(reader.m_first == 10);
+
+    // accès aléatoire, à reculons, puis dans l'ordre: identique bit à bit
+    std::vector<int> order = {5, 2, 6, 6, 0, 4, 3, 1, 0, 1, 2, 3, 4, 5, 6};
+    std::vector<std::vector<double>> comps;
+    arena.execute([&] {
+      for (int f : order) {
+        REQUIRE(reader.read(f, comps));
+        REQUIRE(comps.size() == 3);
+        for (int c = 0; c < 3; c++) {
+          REQUIRE(std::memcmp(comps[c].data(), frames[f][c].data(), w * h * sizeof(double)) == 0);
+        }
+      }
+    });
+    REQUIRE_FALSE(reader.read(7, comps));
+  }
+
+  SECTION("Lossy") {
+    FieldStoreReader reader;
+    REQUIRE(reader.open(lossy));
+    REQUIRE(reader.m_opt.mantissa_bits == 20);
+    std::vector<std::vector<double>> comps;
+    for (int f : {4, 6, 1}) {
+      REQUIRE(reader.read(f, comps));
+      for (int c = 0; c < 3; c++) {
+        for (int p = 0; p < w * h; p++) {
+          double v = frames[f][c][p];
+          REQUIRE(std::abs(comps[c][p] - v) <= std::ldexp(std::abs(v), -21));
+        }
+      }
+    }
+  }
+
+  SECTION("Corrupt") {
+    std::string bytes = lossless.str();
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+    FieldStoreReader reader;
+    REQUIRE_FALSE(reader.open(truncated));
+    std::stringstream fld(raw.str());
+    REQUIRE_FALSE(reader.open(fld));
+  }
+
+  SECTION("Interrupted") {
+    // un index intermédiaire rend lisible un fichier interrompu, et le
+    // fichier complet ignore cet index
+    std::stringstream partial;
+    FieldStore cut(partial, opt, 0);
+    for (int f = 0; f < 7; f++) {
+      std::vector<const double*> components;
+      for (const std::vector<double>& c : frames[f]) {
+        components.push_back(c.data());
+      }
+      cut.write(w, h, components);
+      if (f == 3) {
+        cut.write_index();
+      }
+    }
+    std::stringstream killed(partial.str());
+    FieldStoreReader reader;
+    REQUIRE(reader.open(killed));
+    REQUIRE(reader.frames() == 4);
+    std::vector<std::vector<double>> comps;
+    REQUIRE(reader.read(3, comps));
+    REQUIRE(std::abs(comps[0][7] - frames[3][0][7]) <= std::ldexp(std::abs(frames[3][0][7]), -21));
+
+    cut.finish();
+    REQUIRE(reader.open(partial));
+    REQUIRE(reader.frames() == 7);
+    for (int f : {6, 2, 4}) {
+      REQUIRE(reader.read(f, comps));
+      REQUIRE(std::abs(comps[1][9] - frames[f][1][9]) <= std::ldexp(std::abs(frames[f][1][9]), -21));
+    }
+
+    CHECK(field_store_path("results/champs.fldz", 0) == "results/champs.fldz");
+    CHECK(field_store_path("results/champs.fldz", 41) == "results/champs-000041.fldz");
+  }
+
+  SECTION("Run") {
+    // run() écrit toutes les itérations dans le même fichier
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "potential-test-store.fldz";
+    std::vector<Particle> particles;
+    experiment_random(10, particles);
+    ColorMap cmap;
+    cmap.load(SOURCE_DIR "/data/colormap_parula.png");
+    PotentialParallel sim(w, h);
+    sim.m_rawfmt = path.string();
+    sim.m_progress = false;
+    sim.run(particles, 4, 1e-9, 5, true, cmap, "", false);
+
+    std::ifstream ifs(path, std::ios::binary);
+    FieldStoreReader reader;
+    REQUIRE(reader.open(ifs));
+    REQUIRE(reader.frames() == 5);
+    REQUIRE(reader.m_first == 0);
+    REQUIRE(reader.m_components == 1);
+    std::vector<std::vector<double>> comps;
+    REQUIRE(reader.read(4, comps));
+    REQUIRE(std::equal(comps[0].begin(), comps[0].end(), sim.m_sol.begin()));
+    ifs.close();
+    std::filesystem::remove(path);
+  }
+}